@@ -0,0 +1,92 @@
+/*
+Commands per second for the fork-free builtins against the same commands run as external
+binaries. Each case writes a script of one command repeated, runs the shell on it and
+prints one JSON object.
+
+Build and run from the repo root:
+    gcc -pthread -o shell shell.c
+    gcc -O2 -o builtin_bench bench/builtin_bench.c
+    ./builtin_bench [./shell] [commands]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/wait.h>
+
+struct benchCase{
+    const char *name;           // Reported as "case"
+    const char *builtin;        // Line run by the builtin
+    const char *external;       // Same line forced through fork/spawn + exec by using a path
+};
+
+static const struct benchCase cases[] = {
+    {"true", "true\n", "/bin/true\n"},
+    {"echo", "echo hello world > /dev/null\n", "/bin/echo hello world > /dev/null\n"},
+    {"test", "test 3 -lt 5\n", "/usr/bin/test 3 -lt 5\n"},
+};
+
+/*
+Monotonic clock in nanoseconds
+*/
+static long long nowNs(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+Run shell on a script holding count copies of line, returns commands per second or -1
+*/
+static double runScript(const char* shell, const char* line, long count){
+    char script[] = "/tmp/builtin_benchXXXXXX";
+    int fd = mkstemp(script);
+    FILE *out;
+    long long start;
+    long long elapsed;
+    pid_t pid;
+    int status;
+    long i;
+
+    if(fd < 0 || (out = fdopen(fd, "w")) == NULL){
+        perror("builtin_bench: script");
+        exit(1);
+    }
+    for(i = 0; i < count; i++){
+        fputs(line, out);
+    }
+    fclose(out);
+
+    start = nowNs();
+    pid = fork();
+    if(pid == 0){
+        execl(shell, shell, script, (char*)NULL);
+        perror(shell);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+    elapsed = nowNs() - start;
+    unlink(script);
+    if(WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0){
+        return -1;
+    }
+    return (double)count * 1e9 / (double)elapsed;
+}
+
+int main(int argc, char *argv[]){
+    const char *shell = argc > 1 ? argv[1] : "./shell";
+    long count = argc > 2 ? atol(argv[2]) : 2000;
+    double builtinRate;
+    double externalRate;
+    size_t i;
+
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++){
+        builtinRate = runScript(shell, cases[i].builtin, count * 50);   // Builtins are fast, give them a longer run
+        externalRate = runScript(shell, cases[i].external, count);
+        printf("{\"bench\":\"builtin\",\"case\":\"%s\",\"builtin_commands\":%ld,\"external_commands\":%ld,\"builtin_per_sec\":%.0f,\"external_per_sec\":%.0f,\"speedup\":%.1f}\n",
+               cases[i].name, count * 50, count, builtinRate, externalRate, builtinRate / externalRate);
+    }
+    return 0;
+}
@@ -0,0 +1,46 @@
+/*
+Microbenchmark for parseInputStr(). Parses a set of typical command lines over and
+over and prints the average cost per line as one JSON object.
+
+Build and run from the repo root:
+    gcc -O2 -pthread -o parse_bench bench/parse_bench.c
+    ./parse_bench [iterations]
+*/
+#define main shellMain
+#include "../shell.c"
+#undef main
+
+static const char *sampleLines[] = {
+    "ls -la\n",
+    "echo hello world\n",
+    "cat < input.txt > output.txt\n",
+    "sleep 5 &\n",
+    "grep -n \"some pattern\" file1.c file2.c file3.c > matches.txt\n",
+    "wc -l < /usr/share/dict/words\n",
+    "# just a comment\n",
+    "gcc -O2 -Wall -Wextra -o build/out src/a.c src/b.c src/c.c src/d.c src/e.c src/f.c src/g.c src/h.c -lm -lpthread\n",
+};
+
+int main(int argc, char *argv[]){
+    char line[MAXCHAR];
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    size_t numLines = sizeof(sampleLines) / sizeof(sampleLines[0]);
+    long long start;
+    long long elapsed;
+    long i;
+    size_t j;
+
+    start = nowNs();
+    for(i = 0; i < iterations; i++){
+        for(j = 0; j < numLines; j++){
+            strcpy(line, sampleLines[j]);                       // The parser works in place, give it a fresh line
+            arenaReset(&lineArena);
+            parseInputStr(line, &lineArena);
+        }
+    }
+    elapsed = nowNs() - start;
+
+    printf("{\"bench\":\"parse\",\"lines\":%ld,\"ns_per_line\":%.1f}\n",
+           iterations * (long)numLines, (double)elapsed / ((double)iterations * numLines));
+    return 0;
+}
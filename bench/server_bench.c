@@ -0,0 +1,219 @@
+/*
+Command lines per second through the control socket of one warm "shell -s", against a
+fresh "shell -c" per command. Clients send each line with their stdin, stdout and stderr
+(here /dev/null) and wait for the "status N ..." reply. The concurrent case keeps several
+connections busy at once, each with one line in flight. Prints one JSON object per case.
+
+Build and run from the repo root:
+    gcc -pthread -o shell shell.c
+    gcc -O2 -o server_bench bench/server_bench.c
+    ./server_bench [./shell] [commands]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define CONNECTIONS 16
+
+static const char *shellPath = "./shell";
+static char socketPath[64];
+static int devNull;
+
+/*
+Monotonic clock in nanoseconds
+*/
+static long long nowNs(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+Connect to the serving shell, retrying while it starts up
+*/
+static int connectShell(){
+    struct sockaddr_un addr;
+    int fd;
+    int tries;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketPath);
+    for(tries = 0; tries < 500; tries++){
+        fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0){
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    perror(socketPath);
+    exit(1);
+}
+
+/*
+Send one command line with /dev/null as its stdin, stdout and stderr
+*/
+static void sendLine(int fd, const char* line){
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    int fds[3] = {devNull, devNull, devNull};
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec part;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    part.iov_base = (void*)line;
+    part.iov_len = strlen(line);
+    msg.msg_iov = &part;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if(sendmsg(fd, &msg, 0) < 0){
+        perror("sendmsg");
+        exit(1);
+    }
+}
+
+/*
+Wait for the reply to a line, exits unless it is "status 0"
+*/
+static void readReply(int fd){
+    char reply[256];
+    ssize_t n = recv(fd, reply, sizeof(reply) - 1, 0);
+
+    if(n <= 0 || strncmp(reply, "status 0", 8) != 0){
+        fprintf(stderr, "server_bench: bad reply\n");
+        exit(1);
+    }
+}
+
+static void report(const char* name, long count, long long elapsed){
+    printf("{\"bench\":\"server\",\"case\":\"%s\",\"commands\":%ld,\"per_sec\":%.0f,\"avg_us\":%.1f}\n",
+           name, count, (double)count * 1e9 / (double)elapsed, (double)elapsed / 1e3 / (double)count);
+    fflush(stdout);
+}
+
+/*
+count lines over one connection, one at a time
+*/
+static void sequential(const char* name, const char* line, long count){
+    int fd = connectShell();
+    long long start = nowNs();
+    long i;
+
+    for(i = 0; i < count; i++){
+        sendLine(fd, line);
+        readReply(fd);
+    }
+    report(name, count, nowNs() - start);
+    close(fd);
+}
+
+/*
+count lines over CONNECTIONS connections, each sending its next line as soon as the
+previous one is answered
+*/
+static void concurrent(const char* name, const char* line, long count){
+    struct pollfd conns[CONNECTIONS];
+    long sent = 0;
+    long done = 0;
+    long long start;
+    int i;
+
+    for(i = 0; i < CONNECTIONS; i++){
+        conns[i].fd = connectShell();
+        conns[i].events = POLLIN;
+    }
+    start = nowNs();
+    for(i = 0; i < CONNECTIONS && sent < count; i++, sent++){
+        sendLine(conns[i].fd, line);
+    }
+    while(done < count){
+        if(poll(conns, CONNECTIONS, -1) < 0){
+            perror("poll");
+            exit(1);
+        }
+        for(i = 0; i < CONNECTIONS; i++){
+            if((conns[i].revents & POLLIN) == 0){
+                continue;
+            }
+            readReply(conns[i].fd);
+            done++;
+            if(sent < count){
+                sendLine(conns[i].fd, line);
+                sent++;
+            }
+        }
+    }
+    report(name, count, nowNs() - start);
+    for(i = 0; i < CONNECTIONS; i++){
+        close(conns[i].fd);
+    }
+}
+
+/*
+The same line run by a new shell each time, the cost the server avoids
+*/
+static void freshShells(const char* name, const char* line, long count){
+    long long start = nowNs();
+    pid_t pid;
+    int status;
+    long i;
+
+    for(i = 0; i < count; i++){
+        pid = fork();
+        if(pid == 0){
+            dup2(devNull, STDOUT_FILENO);
+            execl(shellPath, shellPath, "-c", line, (char*)NULL);
+            _exit(127);
+        }
+        waitpid(pid, &status, 0);
+    }
+    report(name, count, nowNs() - start);
+}
+
+int main(int argc, char *argv[]){
+    long count = argc > 2 ? atol(argv[2]) : 5000;
+    pid_t server;
+
+    if(argc > 1){
+        shellPath = argv[1];
+    }
+    if(count < CONNECTIONS){
+        count = CONNECTIONS;
+    }
+    devNull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    snprintf(socketPath, sizeof(socketPath), "/tmp/server_bench.%d.sock", (int)getpid());
+
+    server = fork();
+    if(server == 0){
+        dup2(devNull, STDOUT_FILENO);
+        execl(shellPath, shellPath, "-s", socketPath, (char*)NULL);
+        _exit(127);
+    }
+
+    sequential("builtin", "true\n", count);
+    sequential("external", "/bin/true\n", count);
+    concurrent("external_concurrent", "/bin/true\n", count);
+    freshShells("fresh_shell_builtin", "true", count / 10);
+    freshShells("fresh_shell_external", "/bin/true", count / 10);
+
+    kill(server, SIGINT);                                   // The shell removes its socket on the way out
+    waitpid(server, NULL, 0);
+    return 0;
+}
@@ -0,0 +1,325 @@
+/*
+End-to-end benchmarks for the shell binary. Every case drives the shell without a terminal,
+either by running a generated script (throughput) or by feeding commands to an interactive
+shell through a pipe and timing each round trip to the next prompt (latency). Each case
+prints one JSON object per line, so runs can be diffed or collected by a script.
+
+Build and run from the repo root:
+    gcc -pthread -o shell shell.c
+    gcc -O2 -o shell_bench bench/shell_bench.c
+    ./shell_bench [./shell] [scale]
+
+scale (default 1) multiplies the number of commands of every case.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static const char *shellPath = "./shell";
+static char workDir[] = "/tmp/shell_benchXXXXXX";    // Scripts and redirection targets live here
+
+/*
+Monotonic clock in nanoseconds
+*/
+static long long nowNs(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+Write count copies of line, between an optional first and last line, to a script and time
+"shell script". Returns the wall time in ns, exits if the shell fails.
+*/
+static long long timeScript(const char* name, const char* first, const char* line, long count, const char* last){
+    char script[512];
+    FILE *out;
+    long long start;
+    long long elapsed;
+    pid_t pid;
+    int status;
+    int devNull;
+    long i;
+
+    snprintf(script, sizeof(script), "%s/%s.sh", workDir, name);
+    out = fopen(script, "w");
+    if(out == NULL){
+        perror(script);
+        exit(1);
+    }
+    if(first != NULL){
+        fputs(first, out);
+    }
+    for(i = 0; i < count; i++){
+        fputs(line, out);
+    }
+    if(last != NULL){
+        fputs(last, out);
+    }
+    fclose(out);
+
+    start = nowNs();
+    pid = fork();
+    if(pid == 0){
+        devNull = open("/dev/null", O_WRONLY);              // Completion notices are not what we measure
+        dup2(devNull, STDOUT_FILENO);
+        if(chdir(workDir) != 0){
+            _exit(127);
+        }
+        execl(shellPath, shellPath, script, (char*)NULL);
+        _exit(127);
+    }
+    waitpid(pid, &status, 0);
+    elapsed = nowNs() - start;
+    if(WIFEXITED(status) == 0 || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "shell_bench: %s: shell failed with status %d\n", name, status);
+        exit(1);
+    }
+    return elapsed;
+}
+
+/*
+One throughput result: units/sec and the average cost of one unit
+*/
+static void reportRate(const char* name, const char* unit, long count, long long elapsed){
+    printf("{\"bench\":\"%s\",\"%s\":%ld,\"per_sec\":%.0f,\"avg_us\":%.2f}\n", name, unit, count,
+           (double)count * 1e9 / (double)elapsed, (double)elapsed / 1e3 / (double)count);
+    fflush(stdout);
+}
+
+static int compareNs(const void* a, const void* b){
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+Read the shell's output until it shows the ": " prompt again
+*/
+static void readPrompt(int fd){
+    char buf[4096];
+    char tail[2] = {0, 0};                                  // Last two bytes seen, the prompt may be split
+    ssize_t n;
+
+    while((n = read(fd, buf, sizeof(buf))) > 0){
+        if(n >= 2){
+            tail[0] = buf[n - 2];
+            tail[1] = buf[n - 1];
+        }
+        else{
+            tail[0] = tail[1];
+            tail[1] = buf[0];
+        }
+        if(tail[0] == ':' && tail[1] == ' '){
+            return;
+        }
+    }
+    fprintf(stderr, "shell_bench: shell went away\n");
+    exit(1);
+}
+
+/*
+Round trip from sending line to an interactive shell until its next prompt, count times.
+Prints p50/p90/p99/max in microseconds.
+*/
+static void latency(const char* name, const char* line, long count){
+    long long *samples = malloc(count * sizeof(long long));
+    int toShell[2];
+    int fromShell[2];
+    long long start;
+    size_t len = strlen(line);
+    pid_t pid;
+    long i;
+
+    if(samples == NULL || pipe(toShell) != 0 || pipe(fromShell) != 0){
+        perror("shell_bench");
+        exit(1);
+    }
+    pid = fork();
+    if(pid == 0){
+        dup2(toShell[0], STDIN_FILENO);
+        dup2(fromShell[1], STDOUT_FILENO);
+        close(toShell[0]);
+        close(toShell[1]);
+        close(fromShell[0]);
+        close(fromShell[1]);
+        if(chdir(workDir) != 0){
+            _exit(127);
+        }
+        execl(shellPath, shellPath, (char*)NULL);
+        _exit(127);
+    }
+    close(toShell[0]);
+    close(fromShell[1]);
+
+    readPrompt(fromShell[0]);                               // First prompt
+    for(i = 0; i < count; i++){
+        start = nowNs();
+        if(write(toShell[1], line, len) != (ssize_t)len){
+            perror("shell_bench");
+            exit(1);
+        }
+        readPrompt(fromShell[0]);
+        samples[i] = nowNs() - start;
+    }
+    close(toShell[1]);                                      // End of input exits the shell
+    waitpid(pid, NULL, 0);
+    close(fromShell[0]);
+
+    qsort(samples, count, sizeof(long long), compareNs);
+    printf("{\"bench\":\"%s\",\"commands\":%ld,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+           name, count, samples[count / 2] / 1e3, samples[count * 9 / 10] / 1e3,
+           samples[count * 99 / 100] / 1e3, samples[count - 1] / 1e3);
+    fflush(stdout);
+    free(samples);
+}
+
+/*
+Remove the scripts and files the cases left in workDir
+*/
+static void removeWorkDir(){
+    DIR *dir = opendir(workDir);
+    struct dirent *entry;
+    char path[512];
+
+    if(dir == NULL){
+        return;
+    }
+    while((entry = readdir(dir)) != NULL){
+        if(entry->d_name[0] != '.'){
+            snprintf(path, sizeof(path), "%s/%s", workDir, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    rmdir(workDir);
+}
+
+int main(int argc, char *argv[]){
+    const char *innerLoops = "for b in 0 1 2 3 4 5 6 7 8 9; do for c in 0 1 2 3 4 5 6 7 8 9; do "
+                             "for d in 0 1 2 3 4 5 6 7 8 9; do for e in 0 1 2 3 4 5 6 7 8 9; do "
+                             "for f in 0 1 2 3 4 5 6 7 8 9; do";
+    const char *innerEnds = "done; done; done; done; done;";
+    char longLine[16384];
+    char loopScript[32768];
+    char outerWords[8192];
+    char word[32];
+    char path[512];
+    long scale;
+    long count;
+    size_t used;
+    int i;
+
+    if(argc > 1){
+        shellPath = argv[1];
+    }
+    scale = argc > 2 ? atol(argv[2]) : 1;
+    if(scale < 1){
+        scale = 1;
+    }
+    if(shellPath[0] != '/'){                                // The shell runs inside workDir
+        shellPath = realpath(shellPath, NULL);
+        if(shellPath == NULL){
+            perror(argv[1] != NULL ? argv[1] : "./shell");
+            return 1;
+        }
+    }
+    if(mkdtemp(workDir) == NULL){
+        perror("shell_bench");
+        return 1;
+    }
+
+    /*
+    Spawn throughput: a trivial external command, by both launch paths, and under "limit"
+    (forked so the child sets rlimits, mem= also makes a cgroup per job where cgroup2 is writable)
+    */
+    count = 2000 * scale;
+    reportRate("spawn_external", "commands", count, timeScript("spawn", NULL, "/bin/true\n", count, NULL));
+    reportRate("spawn_external_fork", "commands", count, timeScript("spawn_fork", "launch fork\n", "/bin/true\n", count, NULL));
+    reportRate("spawn_limited", "commands", count, timeScript("spawn_limited", NULL, "limit cpu=3600 nice=1 /bin/true\n", count, NULL));
+    reportRate("spawn_limited_mem", "commands", count, timeScript("spawn_limited_mem", NULL, "limit mem=1G /bin/true\n", count, NULL));
+
+    /*
+    Fork/exec latency as seen at the prompt, and the cost of the loop itself
+    */
+    count = 1000 * scale;
+    latency("prompt_external", "/bin/true\n", count);
+    latency("prompt_builtin", "true\n", count);
+    latency("prompt_blank", "\n", count);
+
+    /*
+    Parser: lines of 500 words, run by the in-process true so only parsing is timed
+    */
+    strcpy(longLine, "true");
+    used = strlen(longLine);
+    for(i = 0; i < 500; i++){
+        snprintf(word, sizeof(word), " \"argument-%d\"", i);
+        memcpy(longLine + used, word, strlen(word));
+        used += strlen(word);
+    }
+    longLine[used++] = '\n';
+    longLine[used] = '\0';
+    count = 2000 * scale;
+    reportRate("parse_long_line", "lines", count, timeScript("parse", NULL, longLine, count, NULL));
+
+    /*
+    Background jobs: launch all of them, then reap them with wait
+    */
+    count = 2000 * scale;
+    reportRate("background_jobs", "jobs", count, timeScript("background", NULL, "/bin/true &\n", count, "wait\n"));
+
+    /*
+    Chatty background jobs: output appended to a log file, against kept in per-job rings in the shell
+    */
+    count = 1000 * scale;
+    reportRate("background_output_file", "jobs", count, timeScript("output_file", NULL, "/bin/seq 10000 >> log.txt &\n", count, "wait\n"));
+    reportRate("background_output_capture", "jobs", count, timeScript("output_capture", "set -o capture\n", "/bin/seq 10000 &\n", count, "wait\n"));
+
+    /*
+    Redirections: both ends redirected, external and in-process, stderr merged into an
+    appended log and a here-string on stdin
+    */
+    count = 2000 * scale;
+    timeScript("seed", "echo redirection benchmark input > in.txt\n", NULL, 0, NULL);
+    reportRate("redirect_external", "commands", count, timeScript("redirect", NULL, "/bin/cat < in.txt > out.txt\n", count, NULL));
+    reportRate("redirect_builtin", "commands", count, timeScript("redirect_builtin", NULL, "echo redirected > out.txt\n", count, NULL));
+    reportRate("redirect_merge", "commands", count, timeScript("merge", NULL, "/bin/cat in.txt >> out.txt 2>&1\n", count, NULL));
+    reportRate("here_string", "commands", count, timeScript("here_string", NULL, "/bin/cat <<< here-string > out.txt\n", count, NULL));
+
+    /*
+    Control flow: 10^6 passes of a builtin from nested for loops, parsed once, against the
+    same number of lines in a flat script, and the same loops calling a shell function
+    */
+    used = 0;
+    for(i = 0; i < 10 * scale && used + 16 < sizeof(outerWords); i++){   // The outer loop sets the scale
+        used += (size_t)snprintf(outerWords + used, sizeof(outerWords) - used, " %d", i);
+    }
+    count = 100000L * i;
+    snprintf(loopScript, sizeof(loopScript), "for a in%s; do %s true; %s done\n", outerWords, innerLoops, innerEnds);
+    reportRate("loop_builtin", "passes", count, timeScript("loop", loopScript, NULL, 0, NULL));
+    snprintf(loopScript, sizeof(loopScript), "f() { true; }\nfor a in%s; do %s f; %s done\n", outerWords, innerLoops, innerEnds);
+    reportRate("loop_function", "calls", count, timeScript("loop_function", loopScript, NULL, 0, NULL));
+    reportRate("flat_builtin", "commands", count, timeScript("flat", NULL, "true\n", count, NULL));
+
+    /*
+    Globbing: one pattern over 1000 files per line, so every line lists the directory, against
+    four patterns per line where three are served from the listing cache
+    */
+    for(i = 0; i < 1000; i++){
+        snprintf(path, sizeof(path), "%s/file%04d.dat", workDir, i);
+        close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+    count = 500 * scale;
+    reportRate("glob_listing", "patterns", count, timeScript("glob", NULL, "true *.dat\n", count, NULL));
+    reportRate("glob_cached", "patterns", count * 4, timeScript("glob_cached", NULL, "true *.dat f*1.dat file0*.dat *[0-4].dat\n", count, NULL));
+
+    removeWorkDir();
+    return 0;
+}
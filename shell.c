@@ -1,545 +1,7553 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <spawn.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <dirent.h>
 
 #define MAXCHAR 2048
 #define MAXARG 512
 
+#define LAUNCH_SPAWN 0          // Launch commands with posix_spawn (vfork-style, no page table copy)
+#define LAUNCH_FORK 1           // Launch commands with plain fork + exec
+
+#define TOKEN_WORD 0            // Lexer token: a word, possibly quoted
+#define TOKEN_REDIR 1           // Lexer token: a redirection operator, '<', '2>>', '>&', '&>', '<<<' ...
+#define TOKEN_BG 2              // Lexer token: '&'
+#define TOKEN_PIPE 3            // Lexer token: '|'
+#define TOKEN_SEMI 4            // Lexer token: ';'
+
+#define REDIR_IN 0              // Redirection: "[n]< file", read a file
+#define REDIR_OUT 1             // Redirection: "[n]> file", create or truncate a file
+#define REDIR_APPEND 2          // Redirection: "[n]>> file", create or append to a file
+#define REDIR_STRING 3          // Redirection: "[n]<<< word", the word and a newline as input
+#define REDIR_DUP 4             // Redirection: "[n]>&m" or "[n]<&m", n becomes a copy of m
+#define REDIR_CLOSE 5           // Redirection: "[n]>&-" or "[n]<&-", close n
+#define MAXREDIRFD 10           // Redirections name fds 0-9, files are opened above them
+
+#define WORD_QUOTED 1           // Word flag: has quotes or backslashes that must be removed
+#define WORD_EXPAND 2           // Word flag: has a '$' outside single quotes
+#define WORD_GLOB 4             // Word flag: has an unquoted '*', '?' or '[', filename expansion may apply
+
+#define JOB_RUNNING 0           // Job state: running
+#define JOB_STOPPED 1           // Job state: stopped by a signal
+#define JOB_DONE 2              // Job state: exited or killed, waiting to be announced
+#define JOB_QUEUED 3            // Job state: waiting for a free slot under "set -j"
+
+#define EVENT_STDIN 1           // epoll tag: stdin has input
+#define EVENT_SIGNAL 2          // epoll tag: signalfd has a pending SIGCHLD/SIGINT/SIGTSTP
+#define EVENT_CHILD 3           // epoll tag: a child's pidfd became readable (it exited)
+#define EVENT_OUTPUT 4          // epoll tag: a background job under "set -o capture" wrote output
+#define EVENT_LISTEN 5          // epoll tag: a client is connecting to the control socket
+#define EVENT_CLIENT 6          // epoll tag: a control socket client sent a command line
+#define OUTPUT_RING 65536       // Bytes of output kept per captured job, a power of two
+#define MAXDONEOUTPUT 64        // Ended jobs whose captured output "jobs -o" can still show
+#define SERVER_MSG 65536        // Longest command line a control socket client may send
+
+#define TRACE_READ 0            // Trace event: a line was read
+#define TRACE_PARSE 1           // Trace event: a line was parsed
+#define TRACE_SPAWN 2           // Trace event: launching a command began, pid of the result
+#define TRACE_EXEC 3            // Trace event: the child is running the new program
+#define TRACE_EXIT 4            // Trace event: the event loop saw the child end
+#define TRACE_REAP 5            // Trace event: the child was reaped, with its status
+#define TRACE_BUILTIN 6         // Trace event: a builtin finished inside the shell
+#define TRACE_RING 4096         // Trace records buffered before events are dropped, a power of two
+#define TRACE_LINE (192 + 3 * 47 * 6)   // Longest JSON line of a record: numbers, keys and three strings of \u00xx escapes
+
+#define NODE_COMMAND 0          // Program node: a pipeline, expanded and run through runCommand()
+#define NODE_IF 1               // Program node: if cond; then body; [elif ... | else orElse;] fi
+#define NODE_WHILE 2            // Program node: while cond; do body; done
+#define NODE_UNTIL 3            // Program node: until cond; do body; done
+#define NODE_FOR 4              // Program node: for name [in words]; do body; done
+#define NODE_GROUP 5            // Program node: { body; }
+#define NODE_FUNCTION 6         // Program node: name() body, defines the function when run
+#define MAXCALLDEPTH 1000       // Function calls and nested $(...) programs running at once
+
+#define EDIT_MORE 0             // Line editor: keep reading keys
+#define EDIT_DONE 1             // Line editor: Enter, the line is complete
+#define EDIT_EOF 2              // Line editor: Ctrl-D on an empty line
+#define HISTORY_CHUNK 65536     // Bytes of the history file searched per step, going back from the end
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+extern char **environ;
+
+/*
+Bump allocator for everything parsed from one line. Reset instead of freed, so once it
+has grown to fit the usual line no more heap allocations happen.
+*/
+struct arenaBlock{
+    struct arenaBlock *next;    // Older block
+    size_t cap;                 // Usable bytes in data
+    size_t used;                // Bytes handed out from data
+    char data[];
+};
+
+struct arena{
+    struct arenaBlock *head;    // Block allocations come from
+    size_t total;               // Sum of all block sizes, the size to keep after a reset
+};
+
+/*
+One process of a job (a pipeline stage)
+*/
+struct jobProc{
+    pid_t pid;              // PID of the process
+    int pidFd;              // pidfd watched by the event loop, -1 if none
+    int status;             // Wait status once it ended
+    bool done;              // Process has been reaped
+};
+
+/*
+What a finished job cost, from wait4()
+*/
+struct jobUsage{
+    long long wallNs;       // From the start to the last stage reaped
+    struct rusage ru;       // CPU time and context switches summed over the stages, the largest max RSS
+};
+
+/*
+Output of a background job under "set -o capture". Every stage's stdout and stderr go into
+one pipe that the event loop reads into a fixed ring, so however much a job writes it holds
+at most OUTPUT_RING bytes, the newest ones.
+*/
+struct jobOutput{
+    int fd;                 // Read end of the pipe, -1 once the job's side closed it
+    char *ring;             // OUTPUT_RING bytes, allocated when the first output arrives
+    unsigned long long total;   // Bytes read so far, the last OUTPUT_RING of them are in ring
+    int jobId;              // %n of the job, kept after the job ended
+    pid_t pid;              // Process group of the job
+    char *cmdLine;          // Command line as typed, taken from the job when it ended
+};
+
+/* 
+A pipeline the shell started: the foreground one, or a background (or stopped) one
+*/
+struct job{
+    int id;                 // Stable job number, used as %n; 0 while in the foreground
+    pid_t pid;              // Process group, the PID of the first stage
+    struct jobProc *procs;  // One entry per pipeline stage that was started
+    int procCount;          // Num of entries in procs
+    int liveCount;          // Num of procs not reaped yet
+    int state;              // JOB_RUNNING, JOB_STOPPED or JOB_DONE
+    int status;             // Wait status once the job is done
+    bool foreground;        // The shell is waiting for this job
+    bool scheduled;         // Counts against the "set -j" limit while it runs
+    int cpu;                // Index in cpuList it was pinned to, -1 if none
+    struct job *nextQueued; // Next job in the scheduler queue
+    long long startNs;      // When the job was started, from nowNs()
+    struct jobUsage usage;  // Resources used by the stages reaped so far
+    struct jobOutput *output;   // Captured stdout and stderr, NULL unless started under "set -o capture"
+    int client;             // Control socket connection waiting for the job's status, -1 if none
+    char *cgroup;           // Own cgroup made for "limit mem=/cpus=", removed with the job; NULL if none
+    char *cmdLine;          // Command line as typed
+    struct inputAttributes *stages; // Queued: the expanded pipeline to launch, kept in mem
+    struct arena mem;       // Queued: holds stages until the job starts
+    size_t slot;            // Position in jobTable.jobs
+};
+
+/*
+Open addressing hash from a pid or job id to its job, linear probing
+*/
+struct jobIndex{
+    int *keys;              // 0 marks an empty slot
+    struct job **vals;
+    size_t cap;             // Num of slots, always a power of two
+    size_t used;            // Num of keys stored
+};
+
 /* 
 Manages background processes
 */
-struct bgProcessStack{
-    int bgPidCount;         // Num of background processes by PID
-    pid_t bgPids[MAXARG];   // For storing PID of each background process
+struct jobTable{
+    struct job **jobs;      // Live jobs in no particular order; removal swaps the last one in
+    size_t count;           // Num of live jobs
+    size_t cap;             // Allocated size of jobs
+    struct jobIndex byPid;  // PID -> job
+    struct jobIndex byId;   // Job id -> job
+    int nextId;             // Next job id handed out; restarts at 1 once the table empties
+    struct job *queueHead;  // Oldest queued job, started first
+    struct job *queueTail;  // Newest queued job
+    int queued;             // Num of jobs in the queue
+    int running;            // Num of scheduled jobs started and not done yet
+};
+
+/*
+Where command lines come from: stdin or a script read in chunks, a memory-mapped script
+file, or the string given to -c. Lines are handed out in place, never copied.
+*/
+struct lineReader{
+    char *buf;              // Input bytes; the mapping, the -c string, or a growable read buffer
+    size_t start;           // First byte not handed out yet
+    size_t scanned;         // Bytes after start already known to hold no '\n'
+    size_t len;             // Num of valid bytes in buf
+    size_t cap;             // Allocated size of a read buffer
+    int fd;                 // Descriptor read from, -1 when the whole input is in buf
+    bool eof;               // Input reached end of file
+    bool pollable;          // fd could be added to epoll (false for regular files)
+};
+
+/*
+One redirection of a command. They are applied in the order written, after the pipes
+of a pipeline, so "cmd > log 2>&1" sends both streams to the file.
+*/
+struct redirection{
+    int type;                   // REDIR_IN ... REDIR_CLOSE
+    int fd;                     // Descriptor of the command it sets up
+    int source;                 // REDIR_DUP: fd copied; files: fd opened by openRedirection(), -1 until then
+    char *word;                 // File name or here-string, expanded
+    struct redirection *next;   // Next redirection, applied after this one
+};
+
+/*
+Limits "nice" and "limit" put on the command after them. Such a command is launched by fork,
+so the child applies them itself before exec and never runs a moment without them.
+*/
+struct jobLimits{
+    int niceness;               // Added to the shell's nice value, 0 leaves it
+    rlim_t cpuSeconds;          // cpu=: soft RLIMIT_CPU, RLIM_INFINITY for none
+    rlim_t memBytes;            // mem=: memory.max of the job's cgroup, RLIMIT_AS without one; RLIM_INFINITY for none
+    char *cpuText;              // cpus= as given, for cpuset.cpus; NULL for none
+    cpu_set_t cpus;             // cpus=: CPUs the job may run on
+    bool memInCgroup;           // memory.max was set for this launch, the child skips RLIMIT_AS
+    int procsFd;                // cgroup.procs of the job's cgroup while it is launched, -1 without one
 };
 
 /* 
-Stores attributes from parsed input 
+Stores attributes from parsed input, everything lives in the line arena
 */
 struct inputAttributes{
     bool activeBackground;      // For keeping track of background processes
-    char inputFile[128];        // For storing string to be read from input file 
-    char outputFile[128];       // For storing string to be written to output file
-    char command[MAXCHAR];      // For storing command string
-    int argNum;                 // For counting the num of arguments when a line is parsed
-    char *arguments[MAXARG];    // For storing the arguments from after input has been parsed
+    struct redirection *redirs; // Redirections in the order written, NULL if none
+    char *command;              // Command name, same as arguments[0]; NULL if only assignments
+    int argNum;                 // Num of words including the command
+    char **arguments;           // Command and its arguments, NULL terminated
+    int assignNum;              // Num of NAME=value words before the command
+    char **assignments;         // Those words, NULL terminated, NULL if none
+    char *cmdLine;              // Copy of the line as typed, kept by jobs
+    struct jobLimits *limits;   // Set on every stage by "nice" and "limit" while it is launched, NULL if none
+    struct inputAttributes *next;   // Next pipeline stage, NULL for the last one
+};
+
+/*
+Growable byte buffer
+*/
+struct textBuf{
+    char *data;
+    size_t len;                 // Bytes in use
+    size_t cap;                 // Bytes allocated
+};
+
+/*
+Names in a directory, read once by listDirectory() and kept until globReset()
+*/
+struct dirEntry{
+    char *name;
+    unsigned char type;         // d_type, DT_UNKNOWN on file systems that don't fill it
+};
+
+struct dirListing{
+    char *path;                 // Directory as the pattern names it, "." for the current one
+    struct dirEntry *entries;   // Everything but "." and "..", in directory order
+    int count;                  // Num of entries, 0 if the directory could not be read
+    struct dirListing *next;    // Listing read before this one
+};
+
+/*
+A token produced by the lexer, words are slices of the line
+*/
+struct token{
+    int type;                   // TOKEN_WORD, TOKEN_REDIR, TOKEN_BG, TOKEN_PIPE or TOKEN_SEMI
+    int flags;                  // WORD_QUOTED, WORD_EXPAND, WORD_GLOB
+    char *start;                // First char of the word in the line
+    size_t len;                 // Length of the word as typed, including quotes
+};
+
+/*
+One command of a parsed program, lists are chained through next. A program is parsed once;
+loop and function bodies then run from here, only expanding the words of each command.
+*/
+struct node{
+    int type;                   // NODE_COMMAND ... NODE_FUNCTION
+    struct token *tokens;       // NODE_COMMAND: its tokens; NODE_FOR: the words after "in"
+    int count;                  // Num of tokens; -1 for a "for" without "in", which uses "$@"
+    char *cmdLine;              // NODE_COMMAND: the command as typed
+    char *name;                 // NODE_FOR: loop variable; NODE_FUNCTION: function name
+    struct node *cond;          // NODE_IF, NODE_WHILE, NODE_UNTIL: list whose status decides
+    struct node *body;          // then/do list, group or function body
+    struct node *orElse;        // NODE_IF: the elif (a nested NODE_IF) or else list, NULL if none
+    struct node *next;          // Next command of the list
+};
+
+/*
+Parser state. While a compound command is open, more lines are read to finish it.
+*/
+struct parser{
+    struct token *tokens;       // Tokens of the current line
+    int count;                  // Num of tokens
+    int pos;                    // Next token
+    int depth;                  // Compound commands open; at 0 the end of the line ends the program
+    bool readMore;              // Lines may be read from the input
+    bool failed;                // A syntax error was reported
+    struct arena *mem;          // Nodes, tokens and the lines they point into
+};
+
+/*
+A shell function, its body copied out of the line it was defined on
+*/
+struct function{
+    char *name;                 // NULL marks an empty slot
+    struct node *body;          // Compound command run for each call
+    struct arena mem;           // Holds body and everything it points to
+};
+
+/*
+Name -> function
+*/
+struct funcTable{
+    struct function *entries;   // Open addressing, linear probing, never removed
+    size_t cap;                 // Num of slots, always a power of two
+    size_t used;                // Num of functions defined
+};
+
+/*
+Launch latency for one launch mode
+*/
+struct launchStats{
+    unsigned long count;        // Num of commands launched in this mode
+    long long totalNs;          // Sum of time the shell was blocked launching
+    long long maxNs;            // Slowest launch seen
+};
+
+/*
+A command run inside the shell process instead of being launched
+*/
+struct builtin{
+    const char *name;           // Command name it answers to
+    int (*run)(int argc, char **argv);  // Returns the exit status
+};
+
+/*
+A resource "ulimit" shows and sets
+*/
+struct ulimitResource{
+    char option;                // Its option letter
+    int resource;               // RLIMIT_...
+    rlim_t unit;                // Bytes or seconds per unit of the values shown and given
+    const char *name;           // Description for "ulimit -a"
+};
+
+/*
+A shell variable
+*/
+struct variable{
+    char *name;                 // NULL marks an empty slot
+    char *value;
+    bool exported;              // Passed to commands in their environment
+};
+
+/*
+Name -> variable, with the environment block for exec built from the exported ones
+*/
+struct varTable{
+    struct variable *entries;   // Open addressing, linear probing
+    size_t cap;                 // Num of slots, always a power of two
+    size_t used;                // Num of variables set
+    char **env;                 // Cached "NAME=value" block, NULL terminated
+    size_t envCount;            // Num of strings in env
+    bool envDirty;              // An exported variable changed since env was built
+};
+
+/*
+A resolved command in the PATH cache
+*/
+struct pathEntry{
+    char *name;                 // Command as typed, NULL marks an empty slot
+    char *path;                 // Absolute path found on PATH, NULL if it went missing
+    unsigned long hits;         // Num of launches served from this entry
+};
+
+/*
+Command name -> path, so PATH is only searched the first time a command runs
+*/
+struct pathCache{
+    struct pathEntry *entries;  // Open addressing, linear probing
+    size_t cap;                 // Num of slots, always a power of two
+    size_t used;                // Num of names stored
+    unsigned long hits;         // Lookups answered from the cache
+    unsigned long misses;       // Lookups that had to search PATH
+};
+
+/*
+One trace event, fixed size so recording is a copy into the ring
+*/
+struct traceRecord{
+    long long ns;               // When it happened, from nowNs()
+    int type;                   // TRACE_READ ... TRACE_BUILTIN
+    pid_t pid;                  // Process it is about, 0 if none
+    int jobId;                  // Job number, 0 for the foreground
+    int value;                  // Line length, stage count or exit status, see traceEvent()
+    unsigned long dropped;      // Events lost so far because the ring was full
+    char command[48];           // Command name, cut to fit
+    char inputFile[48];         // File redirected to stdin
+    char outputFile[48];        // File redirected from stdout
+};
+
+/*
+Single producer (the shell) / single consumer (the writer thread) ring of trace records
+*/
+struct traceRing{
+    struct traceRecord *records;    // TRACE_RING entries
+    _Atomic size_t head;        // Next record the shell fills
+    _Atomic size_t tail;        // Next record the writer formats
+    _Atomic bool stop;          // Writer drains the ring and exits
+    unsigned long dropped;      // Events lost because the ring was full
+    pthread_t writer;           // Thread writing JSON lines to fd
+    int fd;                     // Trace file
+};
+
+/*
+The history file, mapped read-only. Entries are lines, indexed from the end back only
+as far as Up/Down have needed so far, so startup never reads the whole file.
+*/
+struct history{
+    int fd;                     // Opened O_APPEND, -1 if there is no history file
+    char *map;                  // The file's first mapLen bytes, NULL while it is empty
+    size_t mapLen;              // Size of the file when it was last mapped
+    size_t *starts;             // Offsets of the newest entries, newest first
+    size_t count;               // Num of entries in starts
+    size_t cap;                 // Allocated size of starts
+    size_t scanPos;             // Bytes before this offset are not indexed yet
+    bool synced;                // Mapping checked against the file since the prompt appeared
+};
+
+/*
+The line being edited at the prompt
+*/
+struct lineEditor{
+    struct textBuf line;        // The line, not NUL terminated
+    size_t cursor;              // Byte offset of the cursor in line
+    size_t histPos;             // Entry shown: 0 is the line being typed, n is history entry n - 1
+    struct textBuf typed;       // The line being typed, kept while browsing history
+    struct textBuf saved;       // The line before Ctrl-R, restored by Ctrl-G
+    struct textBuf query;       // Ctrl-R search text
+    struct textBuf pending;     // Keys read after Enter, used by the next line
+    struct textBuf screen;      // Output of one redraw
+    bool searching;             // Ctrl-R incremental search is on
+    bool matched;               // matchStart/matchEnd hold the entry found
+    bool failed;                // Nothing (older) matches query
+    size_t matchStart;          // Offset of the matching entry in the history map
+    size_t matchEnd;            // End of that entry
+    char esc[8];                // Escape sequence read so far
+    int escLen;                 // Num of bytes in esc, 0 outside of one
 };
 
 /*
 Globals
 */
-struct bgProcessStack pidStack;
+struct jobTable jobTab;
 int fgVal;                       // Last foreground exit status/signal
 bool runInForeground = false;       // If foreground commands enabled, set to false by default
+int launchMode = LAUNCH_SPAWN;      // How external commands are started, see launchCommand()
+struct launchStats launchStat[2];   // Spawn latency per launch mode
+int epollFd = -1;                   // Event loop: stdin, signalfd and child pidfds
+int signalFd = -1;                  // SIGCHLD, SIGINT and SIGTSTP are read from here instead of handlers
+bool pidfdSupported = true;         // Cleared if the kernel has no pidfd_open, then SIGCHLD scans the stack
+int unwatchedProcs = 0;             // Children without a pidfd, found by scanning on SIGCHLD
+bool substituted = false;           // A "$(...)" ran while the current command was parsed, its status stands for NAME=$(...)
+bool inSubshell = false;            // Forked by startSubshell(): "exit" ends only this process, nothing reaches the parent
+bool atPrompt = false;              // Prompt is showing, so async messages must redraw it
+bool pipeFail = false;              // "set -o pipefail": pipeline status is the last failing stage
+int pipeSize = 0;                   // "set -P bytes": F_SETPIPE_SZ for pipeline pipes, 0 keeps the default
+bool ttyControl = false;            // Interactive on a terminal, so foreground jobs get the terminal
+pid_t shellPgid;                    // Process group to hand the terminal back to
+struct termios shellTermios;        // Terminal modes restored after a foreground job
+int waitTargetId = 0;               // Job the wait builtin is blocked on, 0 if none
+int waitTargetStatus = 0;           // Wait status of waitTargetId once it is reaped
+struct lineReader input;             // Source of command lines
+bool interactive = true;            // Reading commands from stdin: prompt, job control, terminal handling
+struct arena lineArena;             // Parsed commands of the current line
+struct pathCache pathCache;         // Resolved PATH lookups, see resolveCommand()
+struct varTable varTab;             // Shell and exported variables
+char shellPidText[16];              // $$, formatted once
+struct textBuf wordBuf;             // Words being expanded, nested $(...) words go on top
+struct jobUsage fgUsage;            // What the command behind fgVal cost, for "status -v"
+bool fgUsageValid = false;          // fgUsage belongs to the last command (false after in-process builtins)
+int maxJobs = 0;                    // "set -j N": background jobs allowed to run at once, 0 for no limit
+bool spreadCpus = false;            // "set -o affinity": pin each scheduled job to the least used CPU
+int *cpuList = NULL;                // CPUs the shell may run on, filled on first use
+int *cpuLoad = NULL;                // Num of scheduled jobs pinned to each entry of cpuList
+int cpuCount = 0;                   // Num of entries in cpuList
+bool traceOn = false;               // "trace file" or -t: commands are recorded, see traceEvent()
+struct traceRing traceRing;         // Trace records waiting for the writer thread
+bool lineEditing = false;           // Interactive on a terminal: lines are edited in raw mode, see editLine()
+bool editing = false;               // editLine() is waiting for keys, async messages must redraw the line
+struct history hist;                // Command lines from every shell sharing the history file
+struct lineEditor editor;           // State of the prompt line
+const char *promptText = ": ";      // Prompt shown, "> " while the rest of a compound command is read
+struct funcTable funcTab;           // Shell functions
+struct arena execArenas[MAXCALLDEPTH];  // Words of the command running at each call depth, reset per command
+int callDepth = 0;                  // Function calls and $(...) programs running
+struct arena retiredBodies;         // Bodies of functions redefined while one ran, freed back at call depth 0
+char *shellName;                    // $0
+char **positional = NULL;           // $1 ... of the running function or script
+int positionalCount = 0;            // $#
+struct textBuf joinBuf;             // $* (and unsplit $@) joined with spaces
+int loopDepth = 0;                  // Loops running in the current function, for break/continue
+int breakCount = 0;                 // "break n": loops still to leave
+int continueCount = 0;              // "continue n": loops still to leave, the last one continues
+bool returning = false;             // "return" is leaving the current function
+bool interrupted = false;           // SIGINT while a program ran, loops stop
+unsigned int loopPasses = 0;        // Loop passes run, events are polled every 256
+bool captureOutput = false;         // "set -o capture": background jobs write into rings in the shell, see readOutput()
+struct jobOutput *doneOutputs[MAXDONEOUTPUT];   // Captured output of the jobs that ended last
+unsigned int doneOutputCount = 0;   // Outputs ever put in doneOutputs, the next one goes at this index modulo its size
+int listenFd = -1;                  // -s: control socket clients connect to
+const char *serverPath = NULL;      // -s: where that socket is, removed on exit
+int *pendingClients = NULL;         // Connections that sent a line, served one after the other by serve()
+size_t pendingCount = 0;            // Num of entries in pendingClients
+size_t pendingCap = 0;              // Allocated size of pendingClients
+struct arena globArena;             // Directory listings of the current line, see listDirectory()
+struct dirListing *dirCache = NULL; // Listings read since the last globReset()
+struct textBuf globBuf;             // Path being built while a pattern is matched
+char *cgroupBase = NULL;            // cgroup2 directory of the shell, job cgroups for "limit" go below it
+int cgroupState = 0;                // 0 not looked for yet, 1 job cgroups can be made, -1 they can't
+unsigned int cgroupSerial = 0;      // Makes job cgroup names unique
 
 /* 
 Function declaration
 */
-void deleteBgPid(pid_t processId);
-int changeDirectory(char* inputBuffer);
-bool hasSpecialChar(char *str);
-void parseInputStr(char* inputBuffer, struct inputAttributes* obj);
-void listOfArgs(struct inputAttributes* obj, char** argsArray);
-void handleRedirection(struct inputAttributes* obj);
+void indexPut(struct jobIndex* index, int key, struct job* val);
+struct job* indexGet(struct jobIndex* index, int key);
+void indexDelete(struct jobIndex* index, int key);
+struct job* addJob(const char* cmdLine, bool foreground);
+void addJobProc(struct job* j, pid_t pid);
+void assignJobId(struct job* j);
+void removeJob(struct job* j);
+void forgetJobs();
+struct job* findJob(const char* spec);
+void listJobs();
+void waitJobs(struct inputAttributes* obj);
+void killJobs(struct inputAttributes* obj);
+void updateStoppedJobs();
+void signalJob(struct job* j, int sig);
+int changeDirectory(struct inputAttributes* obj);
+bool printEscaped(const char* str);
+int echoBuiltin(int argc, char** argv);
+int trueBuiltin(int argc, char** argv);
+int falseBuiltin(int argc, char** argv);
+int pwdBuiltin(int argc, char** argv);
+int testBuiltin(int argc, char** argv);
+int printfBuiltin(int argc, char** argv);
+const struct builtin* findBuiltin(const char* name);
+void runBuiltin(const struct builtin* cmd, struct inputAttributes* obj);
+void* arenaAlloc(struct arena* mem, size_t size);
+void arenaReset(struct arena* mem);
+void arenaFree(struct arena* mem);
+struct token* lexLine(char* line, struct arena* mem, int* count);
+char* skipSubstitution(char* p);
+void textAppend(struct textBuf* buf, const char* data, size_t len);
+char* wordText(struct token* tok, struct arena* mem);
+void addWordFields(struct inputAttributes* obj, int* cap, struct token* tok, struct arena* mem);
+int globField(struct inputAttributes* obj, int* cap, const char* pattern, struct arena* mem);
+bool globMatch(const char* pattern, size_t len, const char* name);
+struct dirListing* listDirectory();
+void globReset();
+char* readAllFd(int fd, struct arena* mem, size_t* len);
+bool runsInShell(struct inputAttributes* obj);
+bool isShellCommand(const char* name);
+char* commandOutput(const char* text, size_t textLen, struct arena* mem, size_t* outLen);
+pid_t startSubshell();
+struct inputAttributes* parseInputStr(char* inputBuffer, struct arena* mem);
+bool checkTokens(struct token* tokens, int count);
+char* commandText(struct token* tokens, int count, struct arena* mem);
+struct inputAttributes* parseTokens(struct token* tokens, int count, char* cmdLine, struct arena* mem);
+struct node* parseProgram(const char* line, size_t len, struct arena* mem, bool readMore);
+char* continuationLine();
+void runProgram(struct node* n);
+void runNested(struct node* n);
+struct function* findFunction(const char* name);
+void defineFunction(struct node* n);
+void callFunction(struct function* fn, struct inputAttributes* obj);
+void loopControl(struct inputAttributes* obj);
+void returnCommand(struct inputAttributes* obj);
+void shiftCommand(struct inputAttributes* obj);
+const char* positionalText();
+bool redirectShell(struct inputAttributes* obj, int* saved);
+void restoreShell(int* saved);
+struct variable* varFind(const char* name, size_t len);
+char* varGet(const char* name);
+struct variable* varSet(const char* name, const char* value);
+void varUnset(const char* name);
+char** varEnviron();
+char** commandEnviron(struct inputAttributes* obj);
+int lastStatus();
+const char* expandDollar(const char* p, const char* end, size_t* len, char* numBuf);
+void loadVariables();
+void assignVariables(struct inputAttributes* obj);
+void exportVariables(struct inputAttributes* obj);
+void unsetVariables(struct inputAttributes* obj);
+int openRedirection(struct inputAttributes* obj);
+void closeRedirection(struct inputAttributes* obj);
+int hereString(const char* word);
+int shellFd(int fd);
+void spawnRedirection(posix_spawn_file_actions_t* actions, struct inputAttributes* obj);
+void applyRedirection(struct inputAttributes* obj);
+bool applyLimits(struct jobLimits* limits);
+void clearPathCache();
+char* searchPath(const char* name);
+char* resolveCommand(const char* name, bool refresh);
+void hashCommands(struct inputAttributes* obj);
+pid_t launchCommand(struct inputAttributes* obj, int pipeIn, int pipeOut, int errFd, struct job* j, bool takeTerminal);
+struct job* launchPipeline(struct inputAttributes* obj, struct job* j, int outFd);
+void queueJob(struct inputAttributes* obj);
+void unqueueJob(struct job* j);
+int pinLaunch(struct inputAttributes* obj, cpu_set_t* saved);
+void startScheduledJob(struct job* j, int cpu);
+void startQueuedJobs();
+void finishScheduledJob(struct job* j);
+void cancelQueuedJob(struct job* j, int sig);
+void setOptions(struct inputAttributes* obj);
+void launchSettings(struct inputAttributes* obj);
+int startOutput(struct job* j);
+void readOutput(struct jobOutput* out);
+void keepOutput(struct job* j);
+void showOutput(struct inputAttributes* obj);
+void startServer(const char* path);
+void stopServer();
+void serve();
+void acceptClients();
+void serveClient(int fd);
+void replyClient(int fd, int status, const struct jobUsage* usage);
+void closeClient(int fd);
+int runClient(const char* path, char** args);
+long long nowNs();
 void forkOff(struct inputAttributes* obj);
 void stopSig(int sig);
 void childSig(int sig);
 void terminateSig(int sig);
-void freeInputMem(struct inputAttributes* obj);
+void setupEventLoop();
+int watchChild(pid_t pid);
+void unwatchChild(int pidFd);
+bool pollEvents(int timeoutMs);
+void reapChild(pid_t pid);
+void addUsage(struct rusage* total, const struct rusage* ru);
+void formatUsage(char* buf, size_t size, const struct jobUsage* usage);
+void reportBgDone(struct job* j);
+void openInput(struct lineReader* in, const char* script, const char* command);
+char* readInputLine(struct lineReader* in);
+void historyOpen();
+void historySync();
+const char* historyEntry(size_t n, size_t* len);
+void historyAdd(const char* line, size_t len);
+bool historySearch(const char* query, size_t queryLen, size_t before, size_t* hit);
+void historyCommand(struct inputAttributes* obj);
+char* editLine();
+int editorKey(unsigned char c);
+void editorRefresh();
+void redrawPrompt();
+void waitForeground(struct job* j);
 void killBgProcess();
 void switchModes();
+void runCommand(struct inputAttributes* obj);
+void timeCommand(struct inputAttributes* obj);
+bool takeLimits(struct inputAttributes* obj, struct jobLimits* limits);
+void limitCommand(struct inputAttributes* obj);
+void ulimitCommand(struct inputAttributes* obj);
+bool findCgroup();
+void startCgroup(struct job* j, struct jobLimits* limits);
+bool traceOpen(const char* path);
+void traceClose();
+void traceEvent(int type, long long ns, pid_t pid, struct job* j, int value, struct inputAttributes* obj);
+void* traceWriter(void* arg);
+void traceCommand(struct inputAttributes* obj);
 
-int main(){
-    char inputBuffer[MAXCHAR];  // For storing input
-    struct inputAttributes *obj;// Instantiate input attributes
-    int fgStatus;
-    int i;
-    char *source;               // Holds source for when pid is parsed
-    char *dest;                 // Holds destination for when pid is parsed
-    char *assignedPid;          // Holds pid value
+/*
+Builtins run in the shell process, looked up by findBuiltin()
+*/
+const struct builtin builtins[] = {
+    {"echo", echoBuiltin},
+    {"true", trueBuiltin},
+    {"false", falseBuiltin},
+    {"pwd", pwdBuiltin},
+    {"test", testBuiltin},
+    {"[", testBuiltin},
+    {"printf", printfBuiltin},
+};
+
+/*
+Commands runCommand() handles itself, they never start a process either
+*/
+const char *shellCommands[] = {"exit", "cd", "status", "time", "launch", "jobs", "wait", "kill", "set", "hash",
+                               "trace", "export", "unset", "history", "break", "continue", "return", "shift",
+                               "ulimit", "nice", "limit"};
+
+/*
+Resources of "ulimit", -f is the one used when none is named
+*/
+const struct ulimitResource ulimitResources[] = {
+    {'c', RLIMIT_CORE, 1024, "core file size (KiB)"},
+    {'d', RLIMIT_DATA, 1024, "data seg size (KiB)"},
+    {'f', RLIMIT_FSIZE, 1024, "file size (KiB)"},
+    {'l', RLIMIT_MEMLOCK, 1024, "max locked memory (KiB)"},
+    {'m', RLIMIT_RSS, 1024, "max memory size (KiB)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (KiB)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "max user processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (KiB)"},
+};
+
+int main(int argc, char *argv[]){
+    char *inputBuffer;          // Current line, lives in the input reader
+    char *commandString = NULL; // Commands given with -c
+    char *traceFile = NULL;     // Trace file given with -t
+    char *socketPath = NULL;    // Control socket given with -s
+    struct node *program;       // Commands of the line, compound commands read to their end
+    int opt;
 
     /* 
-    A stack for background PIDs
+    Command line options
     */
-    pidStack.bgPidCount = -1;
-    for(i = 0; i < MAXARG; i++){
-        pidStack.bgPids[i] = -1;
+    while((opt = getopt(argc, argv, "+fc:t:s:S:")) != -1){
+        switch(opt){
+            case 'f':                   // Start with the plain fork launch path
+                launchMode = LAUNCH_FORK;
+                break;
+            case 'c':                   // Run the given commands and exit
+                commandString = optarg;
+                break;
+            case 't':                   // Trace every command into a file
+                traceFile = optarg;
+                break;
+            case 's':                   // Serve command lines on a control socket
+                socketPath = optarg;
+                break;
+            case 'S':                   // Hand the rest of the line to a shell serving that socket
+                exit(runClient(optarg, argv + optind));
+            default:
+                fprintf(stderr, "usage: %s [-f] [-t tracefile] [-s socket] [-c commands | script]\n"
+                                "       %s -S socket command ...\n", argv[0], argv[0]);
+                exit(1);
+        }
     }
 
     /* 
-    A struct for initializing stop sig
+    Batch mode: no prompt, no job control, lines run back to back
     */
-    struct sigaction StopSignal;
-    StopSignal.sa_handler = stopSig;
-    StopSignal.sa_flags = 0;
+    if(socketPath != NULL){                                             // Lines only come from clients
+        memset(&input, 0, sizeof(struct lineReader));
+        input.fd = -1;
+    }
+    else{
+        openInput(&input, commandString == NULL && optind < argc ? argv[optind] : NULL, commandString);
+    }
+    interactive = commandString == NULL && optind >= argc && socketPath == NULL;
+    shellName = optind < argc ? argv[optind] : argv[0];                 // The script, or the name after -c's commands
+    if(optind < argc){
+        positional = argv + optind + 1;
+        positionalCount = argc - optind - 1;
+    }
 
-    /* 
-    A struct for initializing terminate sig
-    */
-    struct sigaction TermSignal;
-    TermSignal.sa_handler = terminateSig;
-    StopSignal.sa_flags = 0;
+    jobTab.nextId = 1;  // Job numbers start at %1
+    loadVariables();    // Environment becomes exported shell variables
 
-    /* 
-    A struct for initializing child sig
-    */
-    struct sigaction ChildSignal;
-    ChildSignal.sa_handler = childSig;
-    StopSignal.sa_flags = 0;
+    setupEventLoop();   // Signals and child exits are delivered as events from here on
+
+    atexit(traceClose); // Flush the trace on every way out
+    if(traceFile != NULL && traceOpen(traceFile) == false){      // After setupEventLoop, the writer inherits the blocked signals
+        exit(1);
+    }
+
+    if(socketPath != NULL){
+        startServer(socketPath);
+        serve();
+    }
+
+    lineEditing = ttyControl == true && isatty(STDOUT_FILENO);  // Piped input keeps the plain line reader
+    if(lineEditing == true){
+        historyOpen();
+    }
 
     /* 
     A loop for handling commands & signal handlers
     */  
     do{
-        /* 
-        Reset the sig handlers
-        */
-        sigaction(SIGCHLD, &ChildSignal, NULL);
-        sigaction(SIGTSTP, &StopSignal, NULL);
-        sigaction(SIGINT, &TermSignal, NULL);
+        arenaReset(&lineArena);                                             // Drop the previous line's commands
+        globReset();
+        if(interactive == true){
+            switchModes();   // Switches foreground mode if there is a stop signal
+
+            /* 
+            Print colon symbol as the prompt, the line editor draws its own
+            */
+            if(lineEditing == false){
+                printf("%s", promptText);
+                fflush(stdout);
+            }
+            atPrompt = true;
+        }
+        inputBuffer = lineEditing == true ? editLine() : readInputLine(&input);
+        if(traceOn == true && inputBuffer != NULL){
+            traceEvent(TRACE_READ, 0, 0, NULL, (int)strlen(inputBuffer), NULL);
+        }
+        if(inputBuffer == NULL){                                            // End of input behaves like "exit"
+            killBgProcess();
+            exit(interactive == true ? 0 : lastStatus());
+        }
+        atPrompt = false;
+
+        program = parseProgram(inputBuffer, strlen(inputBuffer), &lineArena, true);   // Parse input
+        if(program == NULL){                                                // Blank line, comment or syntax error
+            continue;
+        }
+
+        interrupted = false;
+        runProgram(program);
+    } while(true);
+    return 0;
+}
+
+/*
+Run one parsed line: a shell builtin, an in-process builtin or external commands.
+Builtins only run on their own, not as a pipeline stage.
+*/
+void runCommand(struct inputAttributes* obj){
+    const struct builtin *cmd;  // In-process builtin for the command, if any
+    struct function *fn;        // Shell function of that name, if any
+    char usage[160];            // Formatted resource usage for "status -v"
+    int fgStatus;
+
+    if(obj->command == NULL && obj->next == NULL){                      // NAME=value ... on its own
+        assignVariables(obj);
+    } else if(obj->command != NULL && strcmp(obj->command, "time") == 0){                              // Run the rest of the line and report its cost
+        timeCommand(obj);
+    } else if(obj->command != NULL && (strcmp(obj->command, "nice") == 0 || strcmp(obj->command, "limit") == 0)){  // Run the rest of the line under limits
+        limitCommand(obj);
+    } else if(obj->next != NULL){
+        forkOff(obj);
+    } else if(strcmp(obj->command, "exit") == 0){                       // Recognizes "exit" command and exits from shell.
+        if(inSubshell == true){                                         // Leaves the subshell only, its jobs and exit handlers are the parent's business
+            fflush(stdout);
+            _exit(obj->arguments[1] != NULL ? atoi(obj->arguments[1]) : 0);
+        }
+        killBgProcess();
+        exit(obj->arguments[1] != NULL ? atoi(obj->arguments[1]) : 0);
+    } else if(strcmp(obj->command, "cd") == 0){                         // Handles directory change
+        changeDirectory(obj);
+    } else if(strcmp(obj->command, "status") == 0){                     // Last foreground exit status
+        if(WEXITSTATUS(fgVal)){
+            fgStatus = WEXITSTATUS(fgVal);                           // See if process has exited
+        } else {
+            fgStatus = WTERMSIG(fgVal);                              // See if process was terminated by signal
+        }
+        printf("exit value %d\n", fgStatus);
+        if(obj->arguments[1] != NULL && strcmp(obj->arguments[1], "-v") == 0 && fgUsageValid == true){
+            formatUsage(usage, sizeof(usage), &fgUsage);            // What the command that set it cost
+            printf("%s\n", usage);
+        }
+    } else if(strcmp(obj->command, "launch") == 0){                     // Show or switch the launch path
+        launchSettings(obj);
+    } else if(strcmp(obj->command, "jobs") == 0){                       // List background and stopped jobs
+        if(obj->arguments[1] != NULL && strcmp(obj->arguments[1], "-o") == 0){
+            showOutput(obj);                                            // Or show what one of them wrote
+        }
+        else{
+            listJobs();
+        }
+    } else if(strcmp(obj->command, "wait") == 0){                       // Wait for one or all jobs
+        waitJobs(obj);
+    } else if(strcmp(obj->command, "kill") == 0){                       // Signal jobs by %n or pid
+        killJobs(obj);
+    } else if(strcmp(obj->command, "set") == 0){                        // Shell options
+        setOptions(obj);
+    } else if(strcmp(obj->command, "hash") == 0){                       // PATH lookup cache
+        hashCommands(obj);
+    } else if(strcmp(obj->command, "trace") == 0){                      // Start or stop the execution trace
+        traceCommand(obj);
+    } else if(strcmp(obj->command, "export") == 0){                     // Pass variables to commands
+        exportVariables(obj);
+    } else if(strcmp(obj->command, "unset") == 0){                      // Forget variables
+        unsetVariables(obj);
+    } else if(strcmp(obj->command, "history") == 0){                    // List past command lines
+        historyCommand(obj);
+    } else if(strcmp(obj->command, "break") == 0 || strcmp(obj->command, "continue") == 0){    // Leave loops
+        loopControl(obj);
+    } else if(strcmp(obj->command, "return") == 0){                     // Leave the function
+        returnCommand(obj);
+    } else if(strcmp(obj->command, "shift") == 0){                      // Drop positional parameters
+        shiftCommand(obj);
+    } else if(strcmp(obj->command, "ulimit") == 0){                     // The shell's own resource limits
+        ulimitCommand(obj);
+    } else if((obj->activeBackground == false || runInForeground == true) && obj->limits == NULL &&
+              (fn = findFunction(obj->command)) != NULL){               // Shell function, runs in the shell
+        callFunction(fn, obj);
+    } else if((obj->activeBackground == false || runInForeground == true) && obj->limits == NULL &&
+              (cmd = findBuiltin(obj->command)) != NULL){               // echo, test, ... without a fork
+        runBuiltin(cmd, obj);
+    } else {
+        forkOff(obj);                                                   // handle commands & manage parent/child processes
+    }
+}
+
+/*
+Slot for key: where it is stored, or the empty slot where it would go
+*/
+static size_t indexSlot(struct jobIndex* index, int key){
+    size_t mask = index->cap - 1;
+    size_t slot = ((unsigned int)key * 2654435761u) & mask;
+
+    while(index->keys[slot] != 0 && index->keys[slot] != key){
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+Add or replace key, doubling the index once it is half full
+*/
+void indexPut(struct jobIndex* index, int key, struct job* val){
+    struct jobIndex bigger;
+    size_t slot;
+    size_t i;
+
+    if((index->used + 1) * 2 > index->cap){
+        bigger.cap = index->cap ? index->cap * 2 : 16;
+        bigger.used = 0;
+        bigger.keys = calloc(bigger.cap, sizeof(int));
+        bigger.vals = calloc(bigger.cap, sizeof(struct job*));
+        if(bigger.keys == NULL || bigger.vals == NULL){
+            perror("job table");
+            exit(1);
+        }
+        for(i = 0; i < index->cap; i++){                        // Rehash everything into the new slots
+            if(index->keys[i] != 0){
+                slot = indexSlot(&bigger, index->keys[i]);
+                bigger.keys[slot] = index->keys[i];
+                bigger.vals[slot] = index->vals[i];
+                bigger.used++;
+            }
+        }
+        free(index->keys);
+        free(index->vals);
+        *index = bigger;
+    }
+    slot = indexSlot(index, key);
+    if(index->keys[slot] == 0){
+        index->used++;
+    }
+    index->keys[slot] = key;
+    index->vals[slot] = val;
+}
+
+/*
+Look up key, NULL if it is not stored
+*/
+struct job* indexGet(struct jobIndex* index, int key){
+    size_t slot;
+
+    if(index->cap == 0 || key == 0){
+        return NULL;
+    }
+    slot = indexSlot(index, key);
+    return index->keys[slot] == key ? index->vals[slot] : NULL;
+}
+
+/*
+Remove key, shifting later entries of its probe run back so no tombstones are needed
+*/
+void indexDelete(struct jobIndex* index, int key){
+    size_t mask = index->cap - 1;
+    size_t hole;
+    size_t next;
+    size_t home;
+
+    if(index->cap == 0){
+        return;
+    }
+    hole = indexSlot(index, key);
+    if(index->keys[hole] != key){
+        return;
+    }
+    index->keys[hole] = 0;
+    index->used--;
+    for(next = (hole + 1) & mask; index->keys[next] != 0; next = (next + 1) & mask){
+        home = ((unsigned int)index->keys[next] * 2654435761u) & mask;
+        if(((next - home) & mask) >= ((next - hole) & mask)){  // Entry may move into the hole without passing its home
+            index->keys[hole] = index->keys[next];
+            index->vals[hole] = index->vals[next];
+            index->keys[next] = 0;
+            hole = next;
+        }
+    }
+}
+
+/*
+Add an empty job to the job table and return it. Background jobs get an id right away,
+a foreground job only if it gets stopped.
+*/
+struct job* addJob(const char* cmdLine, bool foreground){
+    struct job *j = calloc(1, sizeof(struct job));
+
+    if(j == NULL || (j->cmdLine = strdup(cmdLine)) == NULL){
+        perror("job table");
+        exit(1);
+    }
+    if(jobTab.count == jobTab.cap){                             // Grow the job list
+        jobTab.cap = jobTab.cap ? jobTab.cap * 2 : 16;
+        jobTab.jobs = realloc(jobTab.jobs, jobTab.cap * sizeof(struct job*));
+        if(jobTab.jobs == NULL){
+            perror("job table");
+            exit(1);
+        }
+    }
+    j->state = JOB_RUNNING;
+    j->foreground = foreground;
+    j->client = -1;
+    j->startNs = nowNs();
+    j->slot = jobTab.count;
+    jobTab.jobs[jobTab.count++] = j;
+    if(foreground == false){
+        assignJobId(j);
+    }
+    return j;
+}
+
+/*
+Record a pipeline stage, the first one started names the process group
+*/
+void addJobProc(struct job* j, pid_t pid){
+    struct jobProc *proc;
+
+    if((j->procCount & (j->procCount - 1)) == 0){               // Grow at 1, 2, 4, 8... stages
+        j->procs = realloc(j->procs, (j->procCount ? j->procCount * 2 : 1) * sizeof(struct jobProc));
+        if(j->procs == NULL){
+            perror("job table");
+            exit(1);
+        }
+    }
+    proc = &j->procs[j->procCount++];
+    proc->pid = pid;
+    proc->status = 0;
+    proc->done = false;
+    proc->pidFd = -1;
+    if(pid <= 0){                                               // Stage that could not be started, it failed right away
+        proc->status = 1 << 8;
+        proc->done = true;
+        return;
+    }
+    if(j->pid == 0){
+        j->pid = pid;
+    }
+    proc->pidFd = watchChild(pid);
+    if(proc->pidFd < 0){
+        unwatchedProcs++;
+    }
+    j->liveCount++;
+    indexPut(&jobTab.byPid, pid, j);
+}
+
+/*
+Give a job the next %n
+*/
+void assignJobId(struct job* j){
+    j->id = jobTab.nextId++;
+    indexPut(&jobTab.byId, j->id, j);
+}
+
+/*
+Remove a job from the table once it ended
+*/
+void removeJob(struct job* j){
+    struct job *last = jobTab.jobs[--jobTab.count];
+    int i;
+
+    last->slot = j->slot;                                       // Move the last job into the freed position
+    jobTab.jobs[j->slot] = last;
+    for(i = 0; i < j->procCount; i++){
+        if(j->procs[i].pid <= 0){
+            continue;
+        }
+        indexDelete(&jobTab.byPid, j->procs[i].pid);
+        if(j->procs[i].done == false && j->procs[i].pidFd < 0){
+            unwatchedProcs--;
+        }
+        unwatchChild(j->procs[i].pidFd);                        // Stop watching its pidfd
+    }
+    if(j->id != 0){
+        indexDelete(&jobTab.byId, j->id);
+    }
+    if(jobTab.count == 0){
+        jobTab.nextId = 1;
+    }
+    if(j->output != NULL){                                      // Stays readable by "jobs -o" for a while
+        keepOutput(j);
+    }
+    if(j->cgroup != NULL){                                      // Empty now, unless a stage left processes behind
+        rmdir(j->cgroup);
+        free(j->cgroup);
+    }
+    arenaFree(&j->mem);
+    free(j->procs);
+    free(j->cmdLine);
+    free(j);
+}
 
-        usleep(3000);   // To avoid competition between signals and commands that happen at the same time
+/*
+In a subshell: drop the parent's jobs without signalling or waiting for them, they are
+not this process's children
+*/
+void forgetJobs(){
+    struct job *j;
+    size_t i;
+    int k;
 
-        switchModes();   // Switches foreground mode if there is a stop signal
+    for(i = 0; i < jobTab.count; i++){
+        j = jobTab.jobs[i];
+        for(k = 0; k < j->procCount; k++){
+            if(j->procs[k].pidFd >= 0){
+                close(j->procs[k].pidFd);
+            }
+        }
+        if(j->output != NULL){
+            if(j->output->fd >= 0){
+                close(j->output->fd);
+            }
+            free(j->output->ring);
+            free(j->output);
+        }
+        free(j->cgroup);                                        // Only the name, the cgroup is the parent's to remove
+        arenaFree(&j->mem);
+        free(j->procs);
+        free(j->cmdLine);
+        free(j);
+    }
+    jobTab.count = 0;
+    jobTab.nextId = 1;
+    jobTab.queueHead = NULL;
+    jobTab.queueTail = NULL;
+    jobTab.queued = 0;
+    jobTab.running = 0;
+    memset(jobTab.byPid.keys, 0, jobTab.byPid.cap * sizeof(int));
+    jobTab.byPid.used = 0;
+    memset(jobTab.byId.keys, 0, jobTab.byId.cap * sizeof(int));
+    jobTab.byId.used = 0;
+    unwatchedProcs = 0;
+    if(cpuLoad != NULL){
+        memset(cpuLoad, 0, CPU_SETSIZE * sizeof(int));
+    }
+}
+
+/*
+Find a job from "%n" (job id) or a plain pid
+*/
+struct job* findJob(const char* spec){
+    if(spec[0] == '%'){
+        return indexGet(&jobTab.byId, atoi(spec + 1));
+    }
+    return indexGet(&jobTab.byPid, atoi(spec));
+}
+
+static int compareJobIds(const void* a, const void* b){
+    return (*(struct job* const*)a)->id - (*(struct job* const*)b)->id;
+}
+
+/*
+Print every job as "[id] state pid runtime command"
+*/
+void listJobs(){
+    const char *stateNames[4] = {"Running", "Stopped", "Done", "Queued"};
+    struct job **sorted;
+    size_t i;
+
+    if(jobTab.count == 0){
+        return;
+    }
+    sorted = malloc(jobTab.count * sizeof(struct job*));
+    if(sorted == NULL){
+        perror("jobs");
+        return;
+    }
+    memcpy(sorted, jobTab.jobs, jobTab.count * sizeof(struct job*));
+    qsort(sorted, jobTab.count, sizeof(struct job*), compareJobIds);
+    for(i = 0; i < jobTab.count; i++){
+        if(sorted[i]->foreground == true){                      // Only there while a builtin waits on it
+            continue;
+        }
+        printf("[%d] %-8s %d %.1fs %s\n", sorted[i]->id, stateNames[sorted[i]->state], sorted[i]->pid,
+               (nowNs() - sorted[i]->startNs) / 1e9, sorted[i]->cmdLine);
+    }
+    free(sorted);
+}
+
+/*
+"wait" blocks until every running job ends, "wait %n" or "wait pid" until that one does.
+Status is set to the exit status of the waited job.
+*/
+void waitJobs(struct inputAttributes* obj){
+    struct job *j;
+    char *spec;
+    size_t i;
+    int arg;
+    bool running;
+
+    if(obj->argNum == 1){
+        do{
+            running = false;
+            for(i = 0; i < jobTab.count; i++){                  // Stopped jobs would never finish, don't wait on them
+                if(jobTab.jobs[i]->state == JOB_RUNNING || jobTab.jobs[i]->state == JOB_QUEUED){
+                    running = true;
+                    break;
+                }
+            }
+            if(running == true){
+                pollEvents(-1);
+            }
+        } while(running == true);
+        return;
+    }
+
+    for(arg = 1; arg < obj->argNum; arg++){
+        spec = obj->arguments[arg];
+        j = findJob(spec);
+        if(j == NULL){
+            printf("wait: no such job %s\n", spec);
+            fgVal = 127 << 8;
+            continue;
+        }
+        if(j->state == JOB_STOPPED){
+            continue;
+        }
+        waitTargetId = j->id;                                   // reapChild hands back the status when it ends
+        while(waitTargetId != 0){
+            pollEvents(-1);
+        }
+        fgVal = waitTargetStatus;
+    }
+}
+
+/*
+Send sig to every process of a job: its process group with job control, otherwise each live stage
+*/
+void signalJob(struct job* j, int sig){
+    int i;
+
+    if(j->state == JOB_QUEUED){                                 // Nothing started yet
+        return;
+    }
+    if(interactive == true){
+        kill(-j->pid, sig);
+        return;
+    }
+    for(i = 0; i < j->procCount; i++){
+        if(j->procs[i].done == false && j->procs[i].pid > 0){
+            kill(j->procs[i].pid, sig);
+        }
+    }
+}
+
+/*
+"kill [-SIG] %n|pid ..." sends a signal (default SIGTERM) to jobs or pids
+*/
+void killJobs(struct inputAttributes* obj){
+    const char *sigNames[] = {"HUP", "INT", "QUIT", "KILL", "USR1", "USR2", "TERM", "CONT", "STOP", "TSTP"};
+    const int sigNums[] = {SIGHUP, SIGINT, SIGQUIT, SIGKILL, SIGUSR1, SIGUSR2, SIGTERM, SIGCONT, SIGSTOP, SIGTSTP};
+    struct job *j;
+    char *arg;
+    int sig = SIGTERM;
+    size_t i;
+    int next = 1;                                               // Index of the next argument
+
+    arg = obj->arguments[next];
+    if(arg != NULL && arg[0] == '-'){                           // Signal given by number, name or SIGNAME
+        arg++;
+        if(strncmp(arg, "SIG", 3) == 0){
+            arg += 3;
+        }
+        sig = -1;
+        if(arg[0] >= '0' && arg[0] <= '9'){
+            sig = atoi(arg);
+        }
+        for(i = 0; i < sizeof(sigNums) / sizeof(sigNums[0]); i++){
+            if(strcmp(arg, sigNames[i]) == 0){
+                sig = sigNums[i];
+            }
+        }
+        if(sig < 0){
+            printf("kill: unknown signal %s\n", arg);
+            fgVal = 1 << 8;
+            return;
+        }
+        arg = obj->arguments[++next];
+    }
+    if(arg == NULL){
+        printf("usage: kill [-SIG] %%n|pid ...\n");
+        fgVal = 1 << 8;
+        return;
+    }
+
+    fgVal = 0;
+    for(; arg != NULL; arg = obj->arguments[++next]){
+        j = findJob(arg);
+        if(j == NULL && arg[0] == '%'){
+            printf("kill: no such job %s\n", arg);
+            fgVal = 1 << 8;
+            continue;
+        }
+        if(j != NULL && arg[0] == '%' && j->state == JOB_QUEUED){
+            if(sig != 0 && sig != SIGCONT && sig != SIGSTOP && sig != SIGTSTP){
+                cancelQueuedJob(j, sig);                        // Never started, just drop it
+            }
+            continue;
+        }
+        if(j != NULL && arg[0] == '%'){                         // A job is signalled as a whole
+            signalJob(j, sig);
+        }
+        else if(kill(atoi(arg), sig) != 0){
+            printf("kill: %s: %s\n", arg, strerror(errno));
+            fgVal = 1 << 8;
+            continue;
+        }
+        if(j != NULL && j->state == JOB_STOPPED && sig != SIGSTOP && sig != SIGTSTP && sig != SIGCONT){
+            signalJob(j, SIGCONT);                              // A stopped job only acts on the signal once continued
+        }
+    }
+}
+
+/*
+Record stop/continue changes of children without reaping them.
+A stopped foreground job makes waitForeground() return to the prompt.
+*/
+void updateStoppedJobs(){
+    siginfo_t info;
+    struct job *j;
+
+    while(true){
+        memset(&info, 0, sizeof(info));
+        if(waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) != 0 || info.si_pid == 0){
+            return;
+        }
+        j = indexGet(&jobTab.byPid, info.si_pid);
+        if(j != NULL && j->state != JOB_DONE){
+            j->state = info.si_code == CLD_CONTINUED ? JOB_RUNNING : JOB_STOPPED;
+            if(j->state == JOB_STOPPED){
+                j->status = (128 + info.si_status) << 8;        // Status reported for a stopped foreground job
+            }
+        }
+    }
+}
+
+/*
+Handles moving between directories
+*/
+int changeDirectory(struct inputAttributes* obj){
+    char* homeDirPath = varGet("HOME");            // Fetch home dir path
+    char newDirPath[MAXCHAR];                      // Stores new dir path
+    char* dir = obj->arguments[1];                 // Requested dir, NULL for plain "cd"
+
+    globReset();                                   // Relative paths in the listing cache change meaning
+    if(dir == NULL){
+        if(chdir(homeDirPath) != 0){               // If not 0, then directory could not be found
+            printf("directory:%s not found.\n", homeDirPath);
+            return 1;
+        }
+        return 0;
+    }
+
+    memset(newDirPath, '\0', sizeof(newDirPath));   // Clear str & prepare for new dir path
+    
+    /* 
+    Handles commands related to directory
+    */
+    if(dir[0] == '/'){
+        snprintf(newDirPath, sizeof(newDirPath), "%s%s", homeDirPath, dir); // Change to new dir from home dir
+    }
+    else if(strcmp(dir, "~") == 0){                                       // Go to home dir
+        snprintf(newDirPath, sizeof(newDirPath), "%s", homeDirPath);
+    }
+    else{                                                                 // "..", "./x" or a path relative to the current dir
+        snprintf(newDirPath, sizeof(newDirPath), "%s", dir);
+    }
+    if(chdir(newDirPath) != 0){                                // If directory not found
+        printf("directory:%s not found.\n", newDirPath);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+Print the backslash escapes echo -e and printf %b understand. Returns false at "\c", which ends all output.
+*/
+bool printEscaped(const char* str){
+    int value;
+    int digits;
+
+    for(; *str != '\0'; str++){
+        if(*str != '\\' || str[1] == '\0'){
+            putchar(*str);
+            continue;
+        }
+        switch(*++str){
+            case 'a': putchar('\a'); break;
+            case 'b': putchar('\b'); break;
+            case 'c': return false;
+            case 'e': putchar('\033'); break;
+            case 'f': putchar('\f'); break;
+            case 'n': putchar('\n'); break;
+            case 'r': putchar('\r'); break;
+            case 't': putchar('\t'); break;
+            case 'v': putchar('\v'); break;
+            case '\\': putchar('\\'); break;
+            case '0':                                       // \0nnn, up to three octal digits
+                value = 0;
+                for(digits = 0; digits < 3 && str[1] >= '0' && str[1] <= '7'; digits++){
+                    value = value * 8 + (*++str - '0');
+                }
+                putchar(value);
+                break;
+            default:                                        // Unknown escapes are printed as typed
+                putchar('\\');
+                putchar(*str);
+        }
+    }
+    return true;
+}
+
+/*
+"echo [-neE] args..."
+*/
+int echoBuiltin(int argc, char** argv){
+    bool newline = true;
+    bool escapes = false;
+    const char *flag;
+    int i = 1;
+
+    for(; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++){   // Only words made of n, e and E are options
+        for(flag = argv[i] + 1; *flag == 'n' || *flag == 'e' || *flag == 'E'; flag++);
+        if(*flag != '\0'){
+            break;
+        }
+        for(flag = argv[i] + 1; *flag != '\0'; flag++){
+            if(*flag == 'n'){
+                newline = false;
+            }
+            else{
+                escapes = *flag == 'e';
+            }
+        }
+    }
+    for(; i < argc; i++){
+        if(escapes == true){
+            if(printEscaped(argv[i]) == false){
+                return 0;
+            }
+        }
+        else{
+            fputs(argv[i], stdout);
+        }
+        if(i + 1 < argc){
+            putchar(' ');
+        }
+    }
+    if(newline == true){
+        putchar('\n');
+    }
+    return 0;
+}
+
+/*
+"true"
+*/
+int trueBuiltin(int argc, char** argv){
+    (void)argc;
+    (void)argv;
+    return 0;
+}
+
+/*
+"false"
+*/
+int falseBuiltin(int argc, char** argv){
+    (void)argc;
+    (void)argv;
+    return 1;
+}
+
+/*
+"pwd"
+*/
+int pwdBuiltin(int argc, char** argv){
+    char cwd[PATH_MAX];
+
+    (void)argc;
+    (void)argv;
+    if(getcwd(cwd, sizeof(cwd)) == NULL){
+        printf("pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", cwd);
+    return 0;
+}
+
+/*
+Integer operand of test, sets *bad and prints the error if str is not a number
+*/
+static long long testNumber(const char* str, bool* bad){
+    char *end;
+    long long value;
+
+    errno = 0;
+    value = strtoll(str, &end, 10);
+    while(*end == ' ' || *end == '\t'){
+        end++;
+    }
+    if(end == str || *end != '\0' || errno != 0){
+        if(*bad == false){
+            printf("test: %s: integer expression expected\n", str);
+        }
+        *bad = true;
+    }
+    return value;
+}
+
+/*
+True for the binary operators of test
+*/
+static bool testIsBinary(const char* op){
+    const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef"};
+    size_t i;
+
+    for(i = 0; i < sizeof(ops) / sizeof(ops[0]); i++){
+        if(strcmp(op, ops[i]) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+"arg1 op arg2"
+*/
+static bool testBinary(const char* left, const char* op, const char* right, bool* bad){
+    struct stat leftStat;
+    struct stat rightStat;
+    bool haveLeft;
+    bool haveRight;
+    long long a;
+    long long b;
+
+    if(op[0] != '-'){                                       // String comparisons
+        if(strcmp(op, "<") == 0){
+            return strcmp(left, right) < 0;
+        }
+        if(strcmp(op, ">") == 0){
+            return strcmp(left, right) > 0;
+        }
+        return (strcmp(left, right) == 0) == (op[0] != '!');
+    }
+    if((op[1] == 'n' && op[2] == 't') || op[1] == 'o' || (op[1] == 'e' && op[2] == 'f')){   // File comparisons
+        haveLeft = stat(left, &leftStat) == 0;
+        haveRight = stat(right, &rightStat) == 0;
+        if(op[1] == 'e'){
+            return haveLeft && haveRight && leftStat.st_dev == rightStat.st_dev && leftStat.st_ino == rightStat.st_ino;
+        }
+        if(op[1] == 'n'){
+            return haveLeft && (haveRight == false || leftStat.st_mtim.tv_sec > rightStat.st_mtim.tv_sec ||
+                   (leftStat.st_mtim.tv_sec == rightStat.st_mtim.tv_sec && leftStat.st_mtim.tv_nsec > rightStat.st_mtim.tv_nsec));
+        }
+        return haveRight && (haveLeft == false || leftStat.st_mtim.tv_sec < rightStat.st_mtim.tv_sec ||
+               (leftStat.st_mtim.tv_sec == rightStat.st_mtim.tv_sec && leftStat.st_mtim.tv_nsec < rightStat.st_mtim.tv_nsec));
+    }
+    a = testNumber(left, bad);
+    b = testNumber(right, bad);
+    if(strcmp(op, "-eq") == 0) return a == b;
+    if(strcmp(op, "-ne") == 0) return a != b;
+    if(strcmp(op, "-lt") == 0) return a < b;
+    if(strcmp(op, "-le") == 0) return a <= b;
+    if(strcmp(op, "-gt") == 0) return a > b;
+    return a >= b;
+}
+
+/*
+"-op arg". Returns -1 if op is not a unary operator of test.
+*/
+static int testUnary(const char* op, const char* arg){
+    struct stat st;
+
+    if(op[0] != '-' || op[1] == '\0' || op[2] != '\0'){
+        return -1;
+    }
+    switch(op[1]){
+        case 'n': return arg[0] != '\0';
+        case 'z': return arg[0] == '\0';
+        case 't': return isatty(atoi(arg));
+        case 'r': return access(arg, R_OK) == 0;
+        case 'w': return access(arg, W_OK) == 0;
+        case 'x': return access(arg, X_OK) == 0;
+        case 'h':
+        case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        case 'e': case 'f': case 'd': case 's': case 'p':
+        case 'S': case 'b': case 'c': case 'u': case 'g': case 'k':
+            if(stat(arg, &st) != 0){
+                return 0;
+            }
+            switch(op[1]){
+                case 'e': return 1;
+                case 'f': return S_ISREG(st.st_mode);
+                case 'd': return S_ISDIR(st.st_mode);
+                case 's': return st.st_size > 0;
+                case 'p': return S_ISFIFO(st.st_mode);
+                case 'S': return S_ISSOCK(st.st_mode);
+                case 'b': return S_ISBLK(st.st_mode);
+                case 'c': return S_ISCHR(st.st_mode);
+                case 'u': return (st.st_mode & S_ISUID) != 0;
+                case 'g': return (st.st_mode & S_ISGID) != 0;
+                default: return (st.st_mode & S_ISVTX) != 0;
+            }
+    }
+    return -1;
+}
+
+/*
+Recursive descent over the test operands:
+    expr := and {-o and}, and := term {-a term}, term := ! term | ( expr ) | -op arg | arg op arg | arg
+*/
+static bool testExpr(char** argv, int argc, int* pos, bool* bad);
+
+static bool testTerm(char** argv, int argc, int* pos, bool* bad){
+    bool result;
+    int unary;
+    int left = argc - *pos;                                 // Operands not consumed yet
+
+    if(left <= 0){
+        printf("test: argument expected\n");
+        *bad = true;
+        return false;
+    }
+    if(strcmp(argv[*pos], "!") == 0 && left > 1){
+        (*pos)++;
+        return !testTerm(argv, argc, pos, bad);
+    }
+    if(left >= 3 && testIsBinary(argv[*pos + 1])){          // A binary operator wins, so "-n = -n" compares strings
+        *pos += 3;
+        return testBinary(argv[*pos - 3], argv[*pos - 2], argv[*pos - 1], bad);
+    }
+    if(strcmp(argv[*pos], "(") == 0 && left > 1){
+        (*pos)++;
+        result = testExpr(argv, argc, pos, bad);
+        if(*pos >= argc || strcmp(argv[*pos], ")") != 0){
+            printf("test: ')' expected\n");
+            *bad = true;
+            return false;
+        }
+        (*pos)++;
+        return result;
+    }
+    if(left >= 2 && (unary = testUnary(argv[*pos], argv[*pos + 1])) >= 0){
+        *pos += 2;
+        return unary == 1;
+    }
+    return argv[(*pos)++][0] != '\0';                       // A lone word is true if not empty
+}
+
+static bool testAnd(char** argv, int argc, int* pos, bool* bad){
+    bool result = testTerm(argv, argc, pos, bad);
+
+    while(*pos < argc && strcmp(argv[*pos], "-a") == 0){
+        (*pos)++;
+        result = testTerm(argv, argc, pos, bad) && result;
+    }
+    return result;
+}
+
+static bool testExpr(char** argv, int argc, int* pos, bool* bad){
+    bool result = testAnd(argv, argc, pos, bad);
+
+    while(*pos < argc && strcmp(argv[*pos], "-o") == 0){
+        (*pos)++;
+        result = testAnd(argv, argc, pos, bad) || result;
+    }
+    return result;
+}
+
+/*
+"test expr" and "[ expr ]". Returns 0 if true, 1 if false and 2 on a malformed expression.
+*/
+int testBuiltin(int argc, char** argv){
+    bool bad = false;
+    bool result;
+    int pos = 1;
+
+    if(strcmp(argv[0], "[") == 0){
+        if(strcmp(argv[argc - 1], "]") != 0){
+            printf("[: missing ']'\n");
+            return 2;
+        }
+        argc--;
+    }
+    if(argc == 1){                                          // No expression is false
+        return 1;
+    }
+    result = testExpr(argv, argc, &pos, &bad);
+    if(bad == false && pos < argc){
+        printf("test: %s: unexpected operand\n", argv[pos]);
+        bad = true;
+    }
+    return bad == true ? 2 : result == true ? 0 : 1;
+}
+
+/*
+"printf format [args...]". The format is reused until every argument is consumed, missing
+arguments count as "" or 0.
+*/
+int printfBuiltin(int argc, char** argv){
+    char spec[64];                                          // One conversion, rebuilt for the C printf
+    const char *fmt;
+    const char *arg;
+    const char *start;
+    char *end;
+    int next = 2;                                           // Next argument to consume
+    int ret = 0;
+    size_t len;
+    long long number;
+
+    if(argc < 2){
+        printf("usage: printf format [arguments]\n");
+        return 2;
+    }
+    do{
+        for(fmt = argv[1]; *fmt != '\0'; fmt++){
+            if(*fmt == '\\'){                               // Escapes in the format itself
+                spec[0] = fmt[0];
+                spec[1] = fmt[1];
+                len = 2;
+                if(fmt[1] == '0'){
+                    while(len < 5 && fmt[len - 1] >= '0' && fmt[len - 1] <= '7' && fmt[len] >= '0' && fmt[len] <= '7'){
+                        spec[len] = fmt[len];
+                        len++;
+                    }
+                }
+                if(fmt[1] == '\0'){
+                    len = 1;
+                }
+                spec[len] = '\0';
+                if(printEscaped(spec) == false){
+                    return ret;
+                }
+                fmt += len - 1;
+                continue;
+            }
+            if(*fmt != '%'){
+                putchar(*fmt);
+                continue;
+            }
+            if(fmt[1] == '%'){
+                putchar('%');
+                fmt++;
+                continue;
+            }
+            start = fmt++;
+            fmt += strspn(fmt, "-+ #0");                    // Flags, width and precision are passed through
+            fmt += strspn(fmt, "0123456789");
+            if(*fmt == '.'){
+                fmt++;
+                fmt += strspn(fmt, "0123456789");
+            }
+            len = (size_t)(fmt - start);
+            if(*fmt == '\0' || len + 3 > sizeof(spec)){
+                printf("printf: %s: invalid format\n", start);
+                return 1;
+            }
+            arg = next < argc ? argv[next++] : NULL;
+            memcpy(spec, start, len);
+            switch(*fmt){
+                case 's':
+                case 'b':
+                    spec[len] = 's';
+                    spec[len + 1] = '\0';
+                    if(*fmt == 'b'){
+                        if(printEscaped(arg != NULL ? arg : "") == false){
+                            return ret;
+                        }
+                        break;
+                    }
+                    printf(spec, arg != NULL ? arg : "");
+                    break;
+                case 'c':
+                    spec[len] = 'c';
+                    spec[len + 1] = '\0';
+                    if(arg != NULL && arg[0] != '\0'){
+                        printf(spec, arg[0]);
+                    }
+                    break;
+                case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+                    spec[len] = 'l';
+                    spec[len + 1] = 'l';
+                    spec[len + 2] = *fmt;
+                    spec[len + 3] = '\0';
+                    number = 0;
+                    if(arg != NULL && arg[0] != '\0'){
+                        errno = 0;
+                        number = (arg[0] == '\'' || arg[0] == '"') ? (unsigned char)arg[1] : strtoll(arg, &end, 0);
+                        if(arg[0] != '\'' && arg[0] != '"' && (*end != '\0' || errno != 0)){
+                            printf("printf: %s: invalid number\n", arg);
+                            ret = 1;
+                        }
+                    }
+                    printf(spec, number);
+                    break;
+                default:
+                    printf("printf: %%%c: invalid directive\n", *fmt);
+                    return 1;
+            }
+        }
+    } while(next > 2 && next < argc);                       // Reuse the format only if it took arguments
+    return ret;
+}
+
+/*
+Builtin named name, NULL if it has to be run as an external command
+*/
+const struct builtin* findBuiltin(const char* name){
+    size_t i;
+
+    for(i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++){
+        if(strcmp(builtins[i].name, name) == 0){
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+Run a builtin in the shell process. Its redirections are applied to the shell's own fds
+for the duration of the call and put back afterwards. The result becomes the foreground status.
+*/
+void runBuiltin(const struct builtin* cmd, struct inputAttributes* obj){
+    int saved[MAXREDIRFD];
+
+    if(redirectShell(obj, saved) == false){
+        fgVal = 1 << 8;
+        return;
+    }
+
+    fgVal = cmd->run(obj->argNum, obj->arguments) << 8;            // Same encoding as a wait status, for "status"
+    fgUsageValid = false;                                   // Nothing was reaped, timeCommand() measures the shell instead
+    traceEvent(TRACE_BUILTIN, 0, 0, NULL, fgVal >> 8, obj);
+
+    restoreShell(saved);
+}
+
+/*
+Apply obj's redirections to the shell itself, for commands that run in it. The fds they
+replace are kept in saved (MAXREDIRFD entries) for restoreShell(). False if one could not
+be set up.
+*/
+bool redirectShell(struct inputAttributes* obj, int* saved){
+    struct redirection *r;
+    int fd;
+
+    for(fd = 0; fd < MAXREDIRFD; fd++){
+        saved[fd] = -1;
+    }
+    if(obj->redirs == NULL){
+        return true;
+    }
+    if(openRedirection(obj) < 0){
+        return false;
+    }
+    fflush(stdout);                                         // Output so far belongs to the old stdout
+    for(r = obj->redirs; r != NULL; r = r->next){
+        if(saved[r->fd] == -1){
+            saved[r->fd] = fcntl(r->fd, F_DUPFD_CLOEXEC, MAXREDIRFD);
+            if(saved[r->fd] < 0){
+                saved[r->fd] = -2;                          // Was not open, closed again afterwards
+            }
+        }
+        if(r->type == REDIR_CLOSE){
+            close(r->fd);
+        }
+        else if(dup2(r->source, r->fd) < 0){                // A source closed by an earlier redirection
+            printf("%s: bad file descriptor\n", r->word);
+            closeRedirection(obj);
+            restoreShell(saved);
+            return false;
+        }
+    }
+    closeRedirection(obj);
+    return true;
+}
+
+/*
+Put back the fds redirectShell() replaced. Above stderr they can only be the shell's own,
+which are close-on-exec.
+*/
+void restoreShell(int* saved){
+    int fd;
+
+    fflush(stdout);
+    for(fd = 0; fd < MAXREDIRFD; fd++){
+        if(saved[fd] >= 0){
+            dup3(saved[fd], fd, fd > STDERR_FILENO ? O_CLOEXEC : 0);
+            close(saved[fd]);
+        }
+        else if(saved[fd] == -2){
+            close(fd);
+        }
+    }
+}
+
+/*
+Hand out size bytes from the arena, adding a block when the current one is full
+*/
+void* arenaAlloc(struct arena* mem, size_t size){
+    struct arenaBlock *block = mem->head;
+    size_t cap;
+    void *ptr;
+
+    size = (size + 15) & ~(size_t)15;                           // Keep every allocation 16-byte aligned
+    if(block == NULL || block->cap - block->used < size){
+        cap = mem->total > size ? mem->total : size;            // Each new block at least doubles the arena
+        if(cap < 4096){
+            cap = 4096;
+        }
+        block = malloc(sizeof(struct arenaBlock) + cap);
+        if(block == NULL){
+            perror("arena");
+            exit(1);
+        }
+        block->next = mem->head;
+        block->cap = cap;
+        block->used = 0;
+        mem->head = block;
+        mem->total += cap;
+    }
+    ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/*
+Release everything handed out since the last reset. If the line needed more than one block,
+they are merged into one block of the combined size so the next line fits without mallocs.
+*/
+void arenaReset(struct arena* mem){
+    struct arenaBlock *block;
+    struct arenaBlock *next;
+    size_t total = mem->total;
+
+    if(mem->head != NULL && mem->head->next == NULL){           // Steady state, just rewind
+        mem->head->used = 0;
+        return;
+    }
+    for(block = mem->head; block != NULL; block = next){
+        next = block->next;
+        free(block);
+    }
+    mem->head = NULL;
+    mem->total = 0;
+    if(total > 0){
+        arenaAlloc(mem, total);
+        mem->head->used = 0;
+    }
+}
+
+/*
+Give all of an arena's memory back
+*/
+void arenaFree(struct arena* mem){
+    struct arenaBlock *block;
+    struct arenaBlock *next;
+
+    for(block = mem->head; block != NULL; block = next){
+        next = block->next;
+        free(block);
+    }
+    mem->head = NULL;
+    mem->total = 0;
+}
+
+/*
+Length of the redirection operator at p, a leading fd number included ("2>>", "&>", "<<<"),
+0 if p does not start one
+*/
+static size_t redirectionLength(const char* p){
+    const char *op = p;
+
+    while(*op >= '0' && *op <= '9'){
+        op++;
+    }
+    if(*op == '&' && op == p && op[1] == '>'){                  // "&>" and "&>>"
+        return op[2] == '>' ? 3 : 2;
+    }
+    if(*op == '<'){
+        if(op[1] == '<' && op[2] == '<'){                       // Here-string
+            return (size_t)(op - p) + 3;
+        }
+        return (size_t)(op - p) + (op[1] == '&' ? 2 : 1);
+    }
+    if(*op == '>'){
+        return (size_t)(op - p) + (op[1] == '>' || op[1] == '&' ? 2 : 1);
+    }
+    return 0;
+}
+
+/*
+Split a line into tokens in one pass. Words are slices of the line, nothing is copied;
+quotes are only noted here and removed by wordText(). A '#' at the start of a word
+ends the line. Returns NULL on a lexing error.
+*/
+struct token* lexLine(char* line, struct arena* mem, int* count){
+    struct token *tokens;
+    struct token *bigger;
+    int cap = 16;
+    char *p = line;
+    char quote;
+
+    *count = 0;
+    tokens = arenaAlloc(mem, cap * sizeof(struct token));
+    while(true){
+        while(*p == ' ' || *p == '\t' || *p == '\n'){
+            p++;
+        }
+        if(*p == '\0' || *p == '#'){
+            break;
+        }
+        if(*count == cap){                                      // Out of token slots, move to a bigger array
+            bigger = arenaAlloc(mem, cap * 2 * sizeof(struct token));
+            memcpy(bigger, tokens, cap * sizeof(struct token));
+            tokens = bigger;
+            cap *= 2;
+        }
+
+        tokens[*count].flags = 0;
+        tokens[*count].start = p;
+        tokens[*count].len = redirectionLength(p);
+        if(tokens[*count].len > 0){                             // Redirection, with its fd number if it has one
+            tokens[*count].type = TOKEN_REDIR;
+            p += tokens[*count].len;
+            (*count)++;
+            continue;
+        }
+        if(*p == '&' || *p == '|' || *p == ';'){                // Other operators are a single char
+            tokens[*count].type = *p == '&' ? TOKEN_BG : *p == '|' ? TOKEN_PIPE : TOKEN_SEMI;
+            tokens[*count].len = 1;
+            p++;
+            (*count)++;
+            continue;
+        }
+
+        tokens[*count].type = TOKEN_WORD;
+        while(*p != '\0' && strchr(" \t\n<>&|;", *p) == NULL){
+            if(*p == '\\' && p[1] != '\0'){                     // Escaped char is part of the word
+                tokens[*count].flags |= WORD_QUOTED;
+                p += 2;
+            }
+            else if(*p == '\'' || *p == '"'){                   // Quoted section runs to the matching quote
+                tokens[*count].flags |= WORD_QUOTED;
+                quote = *p++;
+                while(*p != quote){
+                    if(*p == '\0'){
+                        printf("syntax error: unterminated %c\n", quote);
+                        return NULL;
+                    }
+                    if(quote == '"' && *p == '\\' && p[1] != '\0'){
+                        p++;
+                    }
+                    else if(quote == '"' && *p == '$'){
+                        tokens[*count].flags |= WORD_EXPAND;
+                        if(p[1] == '('){                        // Skip the whole substitution, quotes inside included
+                            p = skipSubstitution(p + 1);
+                            if(p == NULL){
+                                printf("syntax error: unterminated $(\n");
+                                return NULL;
+                            }
+                            continue;
+                        }
+                    }
+                    p++;
+                }
+                p++;
+            }
+            else if(*p == '$' && p[1] == '('){                  // Substitution may hold blanks and operators
+                tokens[*count].flags |= WORD_EXPAND;
+                p = skipSubstitution(p + 1);
+                if(p == NULL){
+                    printf("syntax error: unterminated $(\n");
+                    return NULL;
+                }
+            }
+            else{
+                if(*p == '$'){
+                    tokens[*count].flags |= WORD_EXPAND;
+                }
+                else if(*p == '*' || *p == '?' || *p == '['){
+                    tokens[*count].flags |= WORD_GLOB;
+                }
+                p++;
+            }
+        }
+        tokens[*count].len = (size_t)(p - tokens[*count].start);
+        (*count)++;
+    }
+    return tokens;
+}
+
+/*
+End of a "$(...)" whose '(' is at p: just past the matching ')', NULL if there is none.
+Quotes and backslashes inside are skipped over, so they may hold parentheses.
+*/
+char* skipSubstitution(char* p){
+    int depth = 0;
+    char quote;
+
+    for(; *p != '\0'; p++){
+        if(*p == '\\' && p[1] != '\0'){
+            p++;
+        }
+        else if(*p == '\'' || *p == '"'){
+            quote = *p;
+            for(p++; *p != quote; p++){
+                if(*p == '\0'){
+                    return NULL;
+                }
+                if(quote == '"' && *p == '\\' && p[1] != '\0'){
+                    p++;
+                }
+            }
+        }
+        else if(*p == '('){
+            depth++;
+        }
+        else if(*p == ')' && --depth == 0){
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+/*
+Append len bytes to a growable buffer
+*/
+void textAppend(struct textBuf* buf, const char* data, size_t len){
+    if(buf->len + len + 1 > buf->cap){
+        buf->cap = buf->cap ? buf->cap * 2 : 256;
+        while(buf->len + len + 1 > buf->cap){
+            buf->cap *= 2;
+        }
+        buf->data = realloc(buf->data, buf->cap);
+        if(buf->data == NULL){
+            perror("expansion");
+            exit(1);
+        }
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+/*
+Append text to wordBuf. With escape set the word is a glob pattern, and '*', '?', '[', ']'
+and '\\' get a backslash so that quoted or expanded text only ever matches itself.
+*/
+static void appendLiteral(const char* text, size_t len, bool escape){
+    size_t i;
+    size_t run;
+
+    if(escape == false){
+        textAppend(&wordBuf, text, len);
+        return;
+    }
+    for(i = 0; i < len; i += run){
+        run = 1;
+        if(memchr("*?[]\\", text[i], 5) != NULL){
+            textAppend(&wordBuf, "\\", 1);
+        }
+        else{
+            for(; i + run < len && memchr("*?[]\\", text[i + run], 5) == NULL; run++);
+        }
+        textAppend(&wordBuf, text + i, run);
+    }
+}
+
+/*
+Append expanded text to wordBuf. With split set, runs of blanks and newlines become a
+single '\0' between fields, the way unquoted $(...) output is split into arguments.
+escape is passed on to appendLiteral().
+*/
+static void appendFields(const char* text, size_t len, bool split, bool escape, size_t fieldStart){
+    size_t i;
+    size_t run;
+
+    if(split == false){
+        appendLiteral(text, len, escape);
+        return;
+    }
+    for(i = 0; i < len; i += run){
+        if(text[i] == ' ' || text[i] == '\t' || text[i] == '\n'){
+            for(run = 1; i + run < len && (text[i + run] == ' ' || text[i + run] == '\t' || text[i + run] == '\n'); run++);
+            if(wordBuf.len > fieldStart && wordBuf.data[wordBuf.len - 1] != '\0'){  // End the field so far
+                textAppend(&wordBuf, "", 1);
+            }
+            continue;
+        }
+        for(run = 1; i + run < len && text[i + run] != ' ' && text[i + run] != '\t' && text[i + run] != '\n'; run++);
+        appendLiteral(text + i, run, escape);
+    }
+}
+
+/*
+Remove the quotes of a word and expand its variables and command substitutions onto
+the end of wordBuf. split makes unquoted $(...) output separate fields, see appendFields().
+pattern keeps the word a glob pattern: only its unquoted '*', '?' and '[' stay special.
+*/
+static void expandWord(struct token* tok, bool split, bool pattern, struct arena* mem){
+    char *p = tok->start;
+    char *end = tok->start + tok->len;
+    char *close;
+    char quote = '\0';
+    char numBuf[16];                                            // $? as text
+    const char *value;
+    size_t fieldStart = wordBuf.len;
+    size_t used;
+    size_t outLen;
+    int i;
+
+    while(p < end){
+        if(quote == '\0' && (*p == '\'' || *p == '"')){        // Opening quote
+            quote = *p++;
+        }
+        else if(quote != '\0' && *p == quote){                  // Closing quote
+            quote = '\0';
+            p++;
+        }
+        else if(*p == '$' && p[1] == '(' && quote != '\''){     // Command substitution, run right here
+            close = skipSubstitution(p + 1);
+            value = commandOutput(p + 2, (size_t)(close - p) - 3, mem, &outLen);
+            appendFields(value, outLen, split == true && quote == '\0', pattern, fieldStart);
+            p = close;
+        }
+        else if(*p == '$' && p + 1 < end && p[1] == '@' && split == true && quote != '\''){   // "$@": a field per parameter
+            for(i = 0; i < positionalCount; i++){
+                if(i > 0){
+                    textAppend(&wordBuf, "", 1);
+                }
+                appendLiteral(positional[i], strlen(positional[i]), pattern);
+            }
+            p += 2;
+        }
+        else if(*p == '$' && quote != '\''){                    // Variable, expanded outside single quotes
+            value = expandDollar(p + 1, end, &used, numBuf);
+            p += 1 + used;
+            if(value != NULL){
+                appendLiteral(value, strlen(value), pattern);
+            }
+        }
+        else if(*p == '\\' && p + 1 < end && (quote == '\0' || (quote == '"' && strchr("\"\\$`", p[1]) != NULL))){
+            appendLiteral(p + 1, 1, pattern);                   // Backslash keeps the next char as is
+            p += 2;
+        }
+        else{
+            appendLiteral(p, 1, pattern == true && quote != '\0');
+            p++;
+        }
+    }
+    if(split == true){
+        while(wordBuf.len > fieldStart && wordBuf.data[wordBuf.len - 1] == '\0'){   // No empty field at the end
+            wordBuf.len--;
+        }
+    }
+}
+
+/*
+Text of a word token. Plain words are returned in place (the parser has already
+terminated them); words with quotes, '$' or "$(...)" are expanded into wordBuf and
+copied into the arena.
+*/
+char* wordText(struct token* tok, struct arena* mem){
+    size_t start = wordBuf.len;                                 // A substitution may expand words of its own meanwhile
+    char *out;
+
+    if((tok->flags & (WORD_QUOTED | WORD_EXPAND)) == 0){
+        return tok->start;
+    }
+    expandWord(tok, false, false, mem);
+    out = arenaAlloc(mem, wordBuf.len - start + 1);
+    memcpy(out, wordBuf.data + start, wordBuf.len - start);
+    out[wordBuf.len - start] = '\0';
+    wordBuf.len = start;
+    return out;
+}
+
+/*
+Whether len chars of a pattern hold an unescaped '*', '?' or a '[' with a ']' after it
+*/
+static bool hasGlob(const char* text, size_t len){
+    size_t i;
+
+    for(i = 0; i < len; i++){
+        if(text[i] == '\\'){
+            i++;
+        }
+        else if(text[i] == '*' || text[i] == '?'){
+            return true;
+        }
+        else if(text[i] == '[' && memchr(text + i + 1, ']', len - i - 1) != NULL){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Drop the backslashes expandWord() put in a pattern, in place
+*/
+static void unescapeGlob(char* text){
+    char *out = text;
+
+    for(; *text != '\0'; text++){
+        if(*text == '\\' && text[1] != '\0'){
+            text++;
+        }
+        *out++ = *text;
+    }
+    *out = '\0';
+}
+
+/*
+Append one argument to obj->arguments, moving them to an array twice the size when full.
+*cap is the size of obj->arguments.
+*/
+static void addArgument(struct inputAttributes* obj, int* cap, char* arg, struct arena* mem){
+    char **bigger;
+
+    if(obj->argNum + 1 >= *cap){                                // Expansion made more words than were typed
+        bigger = arenaAlloc(mem, *cap * 2 * sizeof(char*));
+        memcpy(bigger, obj->arguments, obj->argNum * sizeof(char*));
+        obj->arguments = bigger;
+        *cap *= 2;
+    }
+    obj->arguments[obj->argNum++] = arg;
+}
+
+/*
+Add the arguments a word expands to: usually one, several when an unquoted $(...) is split
+or a pattern matches file names, none when an unquoted expansion came out empty.
+*cap is the size of obj->arguments.
+*/
+void addWordFields(struct inputAttributes* obj, int* cap, struct token* tok, struct arena* mem){
+    size_t start = wordBuf.len;
+    size_t pos;
+    size_t len;
+    bool glob = (tok->flags & WORD_GLOB) != 0;
+    char *field;
+
+    if((tok->flags & (WORD_QUOTED | WORD_EXPAND | WORD_GLOB)) == 0){
+        addArgument(obj, cap, tok->start, mem);
+        return;
+    }
+    if((tok->flags & (WORD_EXPAND | WORD_GLOB)) == 0){
+        addArgument(obj, cap, wordText(tok, mem), mem);
+        return;
+    }
+    expandWord(tok, true, glob, mem);
+    if(wordBuf.len == start && (tok->flags & WORD_QUOTED) != 0){   // "" stays an empty argument
+        textAppend(&wordBuf, "", 1);
+    }
+    for(pos = start; pos < wordBuf.len; pos += len + 1){
+        len = strnlen(wordBuf.data + pos, wordBuf.len - pos);
+        field = arenaAlloc(mem, len + 1);
+        memcpy(field, wordBuf.data + pos, len);
+        field[len] = '\0';
+        if(glob == true && hasGlob(field, len) == true && globField(obj, cap, field, mem) > 0){
+            continue;                                           // Replaced by the names it matched
+        }
+        if(glob == true){
+            unescapeGlob(field);                                // No match: the word itself, as bash does
+        }
+        addArgument(obj, cap, field, mem);
+    }
+    wordBuf.len = start;
+}
+
+/*
+Append len chars of a pattern to globBuf without their escapes
+*/
+static void appendUnescaped(const char* text, size_t len){
+    size_t i;
+
+    for(i = 0; i < len; i++){
+        if(text[i] == '\\' && i + 1 < len){
+            i++;
+        }
+        textAppend(&globBuf, text + i, 1);
+    }
+}
+
+/*
+Whether the name at the end of globBuf is a directory. d_type answers without a syscall;
+symlinks and file systems that leave it DT_UNKNOWN need a stat.
+*/
+static bool globIsDirectory(unsigned char type){
+    struct stat st;
+    bool isDir;
+
+    if(type != DT_LNK && type != DT_UNKNOWN){
+        return type == DT_DIR;
+    }
+    textAppend(&globBuf, "", 1);
+    isDir = stat(globBuf.data, &st) == 0 && S_ISDIR(st.st_mode);
+    globBuf.len--;
+    return isDir;
+}
+
+/*
+Add globBuf as an argument if the path exists (as a directory for a pattern ending in '/').
+Only needed for a literal last component, the others come from a listing.
+*/
+static void globExisting(struct inputAttributes* obj, int* cap, bool dirOnly, struct arena* mem){
+    struct stat st;
+    char *path;
+
+    textAppend(&globBuf, "", 1);
+    if((dirOnly == true ? stat(globBuf.data, &st) : lstat(globBuf.data, &st)) == 0 &&
+       (dirOnly == false || S_ISDIR(st.st_mode))){
+        path = arenaAlloc(mem, globBuf.len);
+        memcpy(path, globBuf.data, globBuf.len);
+        addArgument(obj, cap, path, mem);
+    }
+    globBuf.len--;
+}
+
+/*
+Match the components of pat, from the first one on, below the directory in globBuf and add
+every path that matches. Components without wildcards are taken as they are; the others are
+matched against the cached listing of the directory. Names starting with '.' are only matched
+by a component that starts with '.' too.
+*/
+static void globPath(struct inputAttributes* obj, int* cap, const char* pat, struct arena* mem){
+    struct dirListing *dir;
+    const char *rest = strchr(pat, '/');
+    size_t compLen = rest != NULL ? (size_t)(rest - pat) : strlen(pat);
+    size_t base = globBuf.len;
+    bool last;
+    bool dirOnly;
+    char *path;
+    char *name;
+    int i;
+
+    while(rest != NULL && *rest == '/'){
+        rest++;
+    }
+    last = rest == NULL || *rest == '\0';
+    dirOnly = rest != NULL && *rest == '\0';                    // "pattern/" matches directories only
+
+    if(hasGlob(pat, compLen) == false){
+        appendUnescaped(pat, compLen);
+        if(last == false){
+            textAppend(&globBuf, "/", 1);
+            globPath(obj, cap, rest, mem);
+        }
+        else{
+            if(dirOnly == true){
+                textAppend(&globBuf, "/", 1);
+            }
+            globExisting(obj, cap, dirOnly, mem);
+        }
+        globBuf.len = base;
+        return;
+    }
+
+    dir = listDirectory();
+    for(i = 0; i < dir->count; i++){
+        name = dir->entries[i].name;
+        if(name[0] == '.' && pat[0] != '.' && (pat[0] != '\\' || pat[1] != '.')){
+            continue;
+        }
+        if(globMatch(pat, compLen, name) == false){
+            continue;
+        }
+        textAppend(&globBuf, name, strlen(name));
+        if((last == false || dirOnly == true) && globIsDirectory(dir->entries[i].type) == false){
+            globBuf.len = base;
+            continue;
+        }
+        if(last == false){
+            textAppend(&globBuf, "/", 1);
+            globPath(obj, cap, rest, mem);
+        }
+        else{
+            if(dirOnly == true){
+                textAppend(&globBuf, "/", 1);
+            }
+            path = arenaAlloc(mem, globBuf.len + 1);
+            memcpy(path, globBuf.data, globBuf.len);
+            path[globBuf.len] = '\0';
+            addArgument(obj, cap, path, mem);
+        }
+        globBuf.len = base;
+    }
+}
+
+static int compareNames(const void* a, const void* b){
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+Add the paths a pattern matches to obj->arguments, sorted. Returns how many were added,
+0 if nothing matched.
+*/
+int globField(struct inputAttributes* obj, int* cap, const char* pattern, struct arena* mem){
+    int first = obj->argNum;
+
+    globBuf.len = 0;
+    if(pattern[0] == '/'){
+        textAppend(&globBuf, "/", 1);
+        pattern += strspn(pattern, "/");
+    }
+    globPath(obj, cap, pattern, mem);
+    qsort(obj->arguments + first, obj->argNum - first, sizeof(char*), compareNames);
+    return obj->argNum - first;
+}
+
+/*
+Match c against the class at pattern[p], '[' included. Returns the index just past the
+class if c is in it, 0 if it is not. "[!...]" and "[^...]" negate, a ']' right after the
+'[' (or the '!') is a member, "a-z" is a range. A '[' without a closing ']' is a plain char.
+*/
+static size_t matchClass(const char* pattern, size_t len, size_t p, char c){
+    size_t i = p + 1;
+    bool negate = false;
+    bool found = false;
+    unsigned char lo;
+    unsigned char hi;
+
+    if(i < len && (pattern[i] == '!' || pattern[i] == '^')){
+        negate = true;
+        i++;
+    }
+    if(i < len && pattern[i] == ']'){
+        found = c == ']';
+        i++;
+    }
+    while(i < len && pattern[i] != ']'){
+        if(pattern[i] == '\\' && i + 1 < len){
+            i++;
+        }
+        lo = (unsigned char)pattern[i++];
+        hi = lo;
+        if(i + 1 < len && pattern[i] == '-' && pattern[i + 1] != ']'){
+            i++;
+            if(pattern[i] == '\\' && i + 1 < len){
+                i++;
+            }
+            hi = (unsigned char)pattern[i++];
+        }
+        if((unsigned char)c >= lo && (unsigned char)c <= hi){
+            found = true;
+        }
+    }
+    if(i >= len){
+        return c == '[' ? p + 1 : 0;
+    }
+    return found != negate ? i + 1 : 0;
+}
+
+/*
+Match a name against len chars of a glob pattern, without compiling it. A '*' remembers
+where it was; on a mismatch it takes one more char and matching resumes after it, so the
+cost stays linear in the name for each '*'.
+*/
+bool globMatch(const char* pattern, size_t len, const char* name){
+    const char *n = name;
+    const char *starName = NULL;                                // Where the last '*' started matching
+    size_t starPat = 0;                                         // Pattern index just after that '*'
+    size_t p = 0;
+    size_t next;
+
+    while(*n != '\0'){
+        if(p < len && pattern[p] == '*'){
+            starPat = ++p;
+            starName = n;
+            continue;
+        }
+        next = 0;
+        if(p < len){
+            if(pattern[p] == '?'){
+                next = p + 1;
+            }
+            else if(pattern[p] == '['){
+                next = matchClass(pattern, len, p, *n);
+            }
+            else if(pattern[p] == '\\' && p + 1 < len){
+                next = pattern[p + 1] == *n ? p + 2 : 0;
+            }
+            else{
+                next = pattern[p] == *n ? p + 1 : 0;
+            }
+        }
+        if(next != 0){
+            p = next;
+            n++;
+        }
+        else if(starName != NULL){                              // Let the last '*' take one more char
+            p = starPat;
+            n = ++starName;
+        }
+        else{
+            return false;
+        }
+    }
+    while(p < len && pattern[p] == '*'){
+        p++;
+    }
+    return p == len;
+}
+
+/*
+Listing of the directory in globBuf, read with getdents64 the first time it is asked for
+and then served from dirCache until globReset(). A directory that cannot be read lists empty.
+*/
+struct dirListing* listDirectory(){
+    long buf[4096];                                             // 32 KiB of dirent64 records, aligned for them
+    struct dirListing *dir;
+    struct dirEntry *bigger;
+    struct dirent64 *entry;
+    const char *path;
+    long n;
+    long off;
+    int cap = 64;
+    int fd;
+
+    textAppend(&globBuf, "", 1);
+    path = globBuf.len > 1 ? globBuf.data : ".";
+    for(dir = dirCache; dir != NULL && strcmp(dir->path, path) != 0; dir = dir->next);
+    if(dir != NULL){
+        globBuf.len--;
+        return dir;
+    }
+
+    dir = arenaAlloc(&globArena, sizeof(struct dirListing));
+    dir->path = arenaAlloc(&globArena, strlen(path) + 1);
+    strcpy(dir->path, path);
+    dir->entries = arenaAlloc(&globArena, cap * sizeof(struct dirEntry));
+    dir->count = 0;
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    globBuf.len--;
+    if(fd >= 0){
+        while((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0){
+            for(off = 0; off < n; off += entry->d_reclen){
+                entry = (struct dirent64*)((char*)buf + off);
+                if(entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))){
+                    continue;
+                }
+                if(dir->count == cap){
+                    bigger = arenaAlloc(&globArena, cap * 2 * sizeof(struct dirEntry));
+                    memcpy(bigger, dir->entries, cap * sizeof(struct dirEntry));
+                    dir->entries = bigger;
+                    cap *= 2;
+                }
+                dir->entries[dir->count].name = arenaAlloc(&globArena, strlen(entry->d_name) + 1);
+                strcpy(dir->entries[dir->count].name, entry->d_name);
+                dir->entries[dir->count].type = entry->d_type;
+                dir->count++;
+            }
+        }
+        close(fd);
+    }
+    dir->next = dirCache;
+    dirCache = dir;
+    return dir;
+}
+
+/*
+Forget the cached listings. Called for every command line and loop pass, and whenever the
+shell may have changed a directory itself: a command started, an output file opened, a cd.
+*/
+void globReset(){
+    if(dirCache != NULL){
+        dirCache = NULL;
+        arenaReset(&globArena);
+    }
+}
+
+/*
+Read fd to the end into a buffer in the arena, doubling it as needed
+*/
+char* readAllFd(int fd, struct arena* mem, size_t* len){
+    size_t cap = 4096;
+    char *buf = arenaAlloc(mem, cap);
+    char *bigger;
+    ssize_t n;
+
+    *len = 0;
+    while((n = read(fd, buf + *len, cap - *len)) != 0){
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        *len += (size_t)n;
+        if(*len == cap){
+            bigger = arenaAlloc(mem, cap * 2);
+            memcpy(bigger, buf, *len);
+            buf = bigger;
+            cap *= 2;
+        }
+    }
+    return buf;
+}
+
+/*
+True if runCommand() handles obj without starting a process
+*/
+bool runsInShell(struct inputAttributes* obj){
+    if(obj->next != NULL){
+        return false;
+    }
+    return obj->command == NULL || findBuiltin(obj->command) != NULL || findFunction(obj->command) != NULL ||
+           isShellCommand(obj->command);
+}
+
+/*
+Whether name is one of the shellCommands runCommand() handles itself
+*/
+bool isShellCommand(const char* name){
+    size_t i;
+
+    for(i = 0; i < sizeof(shellCommands) / sizeof(shellCommands[0]); i++){
+        if(strcmp(name, shellCommands[i]) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+Fork a subshell for commands whose effects must stay out of the shell, such as "$(cd dir)"
+or "$(exit 3)". The child gets its own event loop and an empty job table, leaves the control
+socket and the trace to the parent, and never job-controls the terminal. Returns what
+fork() returns; the child must end with _exit().
+*/
+pid_t startSubshell(){
+    struct epoll_event ev;
+    pid_t pid;
+
+    fflush(stdout);                                             // Don't let the child write a pending prompt again
+    pid = fork();
+    if(pid != 0){
+        return pid;
+    }
+    inSubshell = true;
+    interactive = false;
+    ttyControl = false;
+    lineEditing = false;
+    traceOn = false;                                            // The writer thread stayed in the parent
+    serverPath = NULL;                                          // So does the socket file, exit handlers leave it alone
+    if(listenFd >= 0){
+        close(listenFd);
+        listenFd = -1;
+    }
+    pendingCount = 0;
+    close(epollFd);                                             // Shared with the parent, a new set for this process
+    epollFd = shellFd(epoll_create1(EPOLL_CLOEXEC));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (unsigned long long)EVENT_SIGNAL << 32;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &ev);
+    forgetJobs();
+    return 0;
+}
+
+/*
+Output of the commands in text, for "$(...)", without its trailing newlines. A single
+external command or pipeline writes into a pipe that is read while it runs. echo, printf,
+test, true, false and pwd change nothing in the shell, so they run in it with stdout on a
+memfd and never fork. Anything else that would run in the shell (cd, exit, set, functions,
+lists of commands) runs in a subshell writing into the pipe. Sets the status like any command.
+*/
+char* commandOutput(const char* text, size_t textLen, struct arena* mem, size_t* outLen){
+    struct inputAttributes *obj = NULL;
+    struct node *program;
+    struct job *j;
+    char *out;
+    int capture[2];
+    int savedOut;
+    int status;
+    pid_t pid;
+
+    *outLen = 0;
+    program = parseProgram(text, textLen, mem, false);
+    if(program == NULL){
+        return "";
+    }
+    if(program->type == NODE_COMMAND && program->next == NULL){
+        obj = parseTokens(program->tokens, program->count, program->cmdLine, mem);
+        obj->activeBackground = false;                          // The output is needed now
+    }
+
+    if(obj != NULL && obj->next == NULL && obj->command != NULL && obj->assignNum == 0 &&
+       findFunction(obj->command) == NULL && findBuiltin(obj->command) != NULL){
+        capture[0] = memfd_create("substitution", MFD_CLOEXEC);
+        if(capture[0] < 0){
+            perror("memfd_create");
+            return "";
+        }
+        fflush(stdout);
+        savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+        dup2(capture[0], STDOUT_FILENO);
+        runCommand(obj);
+        fflush(stdout);
+        dup2(savedOut, STDOUT_FILENO);
+        close(savedOut);
+        lseek(capture[0], 0, SEEK_SET);
+        out = readAllFd(capture[0], mem, outLen);
+        close(capture[0]);
+    }
+    else if(obj == NULL || runsInShell(obj) == true){
+        if(pipe2(capture, O_CLOEXEC) < 0){
+            perror("pipe");
+            return "";
+        }
+        pid = startSubshell();
+        if(pid == 0){
+            dup2(capture[1], STDOUT_FILENO);
+            close(capture[0]);
+            close(capture[1]);
+            if(obj != NULL){
+                runCommand(obj);
+            }
+            else{
+                runNested(program);
+            }
+            fflush(stdout);
+            _exit(lastStatus());
+        }
+        close(capture[1]);
+        if(pid < 0){
+            perror("fork");
+            close(capture[0]);
+            fgVal = 1 << 8;
+            return "";
+        }
+        out = readAllFd(capture[0], mem, outLen);
+        close(capture[0]);
+        while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        fgVal = status;
+        fgUsageValid = false;
+    }
+    else{
+        if(pipe2(capture, O_CLOEXEC) < 0){
+            perror("pipe");
+            return "";
+        }
+        j = launchPipeline(obj, NULL, capture[1]);
+        close(capture[1]);                                      // Only the children hold the write end now
+        out = readAllFd(capture[0], mem, outLen);
+        close(capture[0]);
+        if(j != NULL){
+            waitForeground(j);
+        }
+        else{
+            fgVal = 1 << 8;
+        }
+    }
+    while(*outLen > 0 && out[*outLen - 1] == '\n'){
+        (*outLen)--;
+    }
+    substituted = true;                                         // Set after the parse of the inner command reset it
+    return out;
+}
+
+/*
+True for a NAME=value word
+*/
+static bool isAssignment(struct token* tok){
+    char *p = tok->start;
+
+    if(*p != '_' && (*p < 'A' || *p > 'Z') && (*p < 'a' || *p > 'z')){
+        return false;
+    }
+    while(*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9')){
+        p++;
+    }
+    return *p == '=';
+}
+
+/*
+Name of a token for syntax error messages
+*/
+static const char* tokenName(struct token* tokens, int i, int count){
+    const char *names[] = {"word", "", "&", "|", ";"};
+    static char redir[16];
+
+    if(i < count && tokens[i].type == TOKEN_REDIR){             // Operators have a length, show the one typed
+        snprintf(redir, sizeof(redir), "%.*s", (int)tokens[i].len, tokens[i].start);
+        return redir;
+    }
+    return i >= count ? "newline" : names[tokens[i].type];
+}
+
+/*
+For initializing inputAttributes structs from one line, one per pipeline stage linked
+through next. Returns NULL for blank lines, comments and syntax errors.
+*/
+struct inputAttributes* parseInputStr(char* inputBuffer, struct arena* mem){
+    struct token *tokens;
+    int count;
+
+    tokens = lexLine(inputBuffer, mem, &count);
+    if(tokens == NULL || count == 0 || checkTokens(tokens, count) == false){
+        return NULL;
+    }
+    return parseTokens(tokens, count, commandText(tokens, count, mem), mem);
+}
+
+/*
+Check the syntax of one pipeline's tokens, a trailing '&' included. Prints the error.
+*/
+bool checkTokens(struct token* tokens, int count){
+    int words = 0;
+    int i;
+
+    if(tokens[count - 1].type == TOKEN_BG){
+        count--;
+    }
+    for(i = 0; i < count; i++){
+        if(tokens[i].type == TOKEN_BG || tokens[i].type == TOKEN_SEMI){
+            printf("syntax error near unexpected token `%s'\n", tokenName(tokens, i, count));
+            return false;
+        }
+        if(tokens[i].type == TOKEN_PIPE){
+            if(words == 0 || i + 1 == count){                   // Every stage needs a command
+                printf("syntax error near unexpected token `|'\n");
+                return false;
+            }
+            words = 0;
+        }
+        else if(tokens[i].type != TOKEN_WORD){                  // Redirection needs a file name after it
+            if(i + 1 == count || tokens[i + 1].type != TOKEN_WORD){
+                printf("syntax error near unexpected token `%s'\n", tokenName(tokens, i + 1, count));
+                return false;
+            }
+            if(tokens[i].start[0] >= '0' && tokens[i].start[0] <= '9' && strtol(tokens[i].start, NULL, 10) >= MAXREDIRFD){
+                printf("%.*s: bad file descriptor\n", (int)strspn(tokens[i].start, "0123456789"), tokens[i].start);
+                return false;
+            }
+            i++;
+        }
+        else{
+            words++;
+        }
+    }
+    if(words == 0){
+        printf("syntax error: missing command\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+Copy of the text the tokens were lexed from, kept by jobs. Taken before words get terminated.
+*/
+char* commandText(struct token* tokens, int count, struct arena* mem){
+    char *lineEnd = tokens[count - 1].start + tokens[count - 1].len;
+    char *cmdLine = arenaAlloc(mem, (size_t)(lineEnd - tokens[0].start) + 1);
+
+    memcpy(cmdLine, tokens[0].start, (size_t)(lineEnd - tokens[0].start));
+    cmdLine[lineEnd - tokens[0].start] = '\0';
+    return cmdLine;
+}
+
+/*
+Append the redirection of operator token op and its expanded word at tail, returns the new
+tail. "&> file" and ">& file" add "> file" followed by "2>&1".
+*/
+static struct redirection** addRedirection(struct redirection** tail, struct token* op, char* word, struct arena* mem){
+    struct redirection *r = arenaAlloc(mem, sizeof(struct redirection));
+    char *p = op->start;
+    bool both = *p == '&';
+    size_t digits;
+
+    r->fd = -1;
+    if(*p >= '0' && *p <= '9'){                                 // checkTokens() kept it below MAXREDIRFD
+        r->fd = (int)strtol(p, &p, 10);
+    }
+    if(*p == '&'){
+        p++;
+    }
+    if(*p == '<'){
+        r->type = p[1] == '<' ? REDIR_STRING : p[1] == '&' ? REDIR_DUP : REDIR_IN;
+    }
+    else{
+        r->type = p[1] == '>' ? REDIR_APPEND : p[1] == '&' ? REDIR_DUP : REDIR_OUT;
+    }
+    r->source = -1;
+    r->word = word;
+    r->next = NULL;
+    if(r->type == REDIR_DUP){
+        digits = strspn(word, "0123456789");
+        if(strcmp(word, "-") == 0){
+            r->type = REDIR_CLOSE;
+        }
+        else if(digits > 0 && digits < 10 && word[digits] == '\0'){
+            r->source = atoi(word);
+        }
+        else if(*p == '>' && r->fd < 0){                       // ">& file" is "&> file"
+            r->type = REDIR_OUT;
+            both = true;
+        }                                                       // Otherwise source stays -1, openRedirection() reports it
+    }
+    if(r->fd < 0){
+        r->fd = *p == '<' ? STDIN_FILENO : STDOUT_FILENO;
+    }
+    *tail = r;
+    tail = &r->next;
+
+    if(both == true){
+        r = arenaAlloc(mem, sizeof(struct redirection));
+        r->type = REDIR_DUP;
+        r->fd = STDERR_FILENO;
+        r->source = STDOUT_FILENO;
+        r->word = NULL;
+        r->next = NULL;
+        *tail = r;
+        tail = &r->next;
+    }
+    return tail;
+}
+
+/*
+Build the pipeline stages from checked tokens, expanding words. Plain words are terminated
+in place and used as they are, which can be done again, so the tokens of a loop body are
+only lexed once and run from here every pass.
+*/
+struct inputAttributes* parseTokens(struct token* tokens, int count, char* cmdLine, struct arena* mem){
+    struct inputAttributes *head = NULL;
+    struct inputAttributes **link = &head;
+    struct inputAttributes *obj;
+    struct redirection **redirTail;                             // Where the stage's next redirection goes
+    bool background = false;
+    int words;
+    int first;
+    int stages = 0;
+    int argCap;                                                 // Size of the current stage's arguments array
+    int i;
+
+    substituted = false;
+    if(tokens[count - 1].type == TOKEN_BG){                     // Check if bg mode
+        background = true;                                      // Bg mode is on
+        count--;                                                // Ignore and remove '&'
+    }
+
+    for(i = 0; i < count; i++){                                 // Operators were recorded, so words can be terminated in place
+        if(tokens[i].type == TOKEN_WORD){
+            tokens[i].start[tokens[i].len] = '\0';
+        }
+    }
+
+    for(first = 0; first < count; first = i + 1){
+        words = 0;
+        for(i = first; i < count && tokens[i].type != TOKEN_PIPE; i++){
+            if(tokens[i].type != TOKEN_WORD){
+                i++;                                            // Skip the file name
+            }
+            else{
+                words++;
+            }
+        }
+
+        obj = arenaAlloc(mem, sizeof(struct inputAttributes));
+        memset(obj, 0, sizeof(struct inputAttributes));
+        argCap = words + 1;
+        obj->arguments = arenaAlloc(mem, argCap * sizeof(char*));
+        redirTail = &obj->redirs;
+        for(i = first; i < count && tokens[i].type != TOKEN_PIPE; i++){
+            if(tokens[i].type == TOKEN_REDIR){                  // Operator and the file name or word after it
+                redirTail = addRedirection(redirTail, &tokens[i], wordText(&tokens[i + 1], mem), mem);
+                i++;
+            }
+            else if(obj->argNum == 0 && isAssignment(&tokens[i])){ // NAME=value before the command
+                if(obj->assignments == NULL){
+                    obj->assignments = arenaAlloc(mem, (words + 1) * sizeof(char*));
+                }
+                obj->assignments[obj->assignNum++] = wordText(&tokens[i], mem);
+            }
+            else{
+                addWordFields(obj, &argCap, &tokens[i], mem);   // $(...) may split into several arguments
+            }
+        }
+        obj->arguments[obj->argNum] = NULL;                     // Close argument array
+        if(obj->assignments != NULL){
+            obj->assignments[obj->assignNum] = NULL;
+        }
+        obj->command = obj->arguments[0];                       // NULL for a stage of assignments only
+        *link = obj;
+        link = &obj->next;
+        stages++;
+    }
+
+    head->activeBackground = background;
+    head->cmdLine = cmdLine;
+    traceEvent(TRACE_PARSE, 0, 0, NULL, stages, head);
+    return head;
+}
+
+/*
+Words that close a list; anywhere else they are a syntax error
+*/
+static const char *closingWords[] = {"then", "elif", "else", "fi", "do", "done", "}"};
+
+/*
+True if tok is the unquoted word w, which is how reserved words are recognized
+*/
+static bool isWord(struct token* tok, const char* w){
+    return tok->type == TOKEN_WORD && tok->flags == 0 && tok->len == strlen(w) && memcmp(tok->start, w, tok->len) == 0;
+}
+
+static bool isClosingWord(struct token* tok){
+    size_t i;
+
+    for(i = 0; i < sizeof(closingWords) / sizeof(closingWords[0]); i++){
+        if(isWord(tok, closingWords[i]) == true){
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+True for a name that can be a variable or a function
+*/
+static bool isName(const char* p, size_t len){
+    size_t i;
+
+    if(len == 0 || (*p != '_' && (*p < 'A' || *p > 'Z') && (*p < 'a' || *p > 'z'))){
+        return false;
+    }
+    for(i = 1; i < len; i++){
+        if(p[i] != '_' && (p[i] < 'A' || p[i] > 'Z') && (p[i] < 'a' || p[i] > 'z') && (p[i] < '0' || p[i] > '9')){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Report the token the parser stopped at as unexpected
+*/
+static void parseError(struct parser* p){
+    struct token *tok = &p->tokens[p->pos];
+
+    if(p->pos == p->count){
+        printf("syntax error near unexpected token `newline'\n");
+    }
+    else if(tok->type == TOKEN_WORD){
+        printf("syntax error near unexpected token `%.*s'\n", (int)tok->len, tok->start);
+    }
+    else{
+        printf("syntax error near unexpected token `%s'\n", tokenName(p->tokens, p->pos, p->count));
+    }
+    p->failed = true;
+}
+
+/*
+Lex the next line of input for an open compound command. False at the end of the input.
+*/
+static bool nextLine(struct parser* p){
+    char *line = p->readMore == true ? continuationLine() : NULL;
+    char *copy;
+    size_t len;
+
+    if(line == NULL){
+        printf("syntax error: unexpected end of file\n");
+        p->failed = true;
+        return false;
+    }
+    len = strlen(line);
+    copy = arenaAlloc(p->mem, len + 1);                         // Tokens must outlive the reader's buffer
+    memcpy(copy, line, len + 1);
+    p->tokens = lexLine(copy, p->mem, &p->count);
+    p->pos = 0;
+    if(p->tokens == NULL){
+        p->count = 0;
+        p->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/*
+Make sure a token is there, reading lines (blank ones skipped) as needed
+*/
+static bool moreTokens(struct parser* p){
+    while(p->pos == p->count){
+        if(nextLine(p) == false){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Consume the reserved word w that must end a non-empty list
+*/
+static bool expectWord(struct parser* p, struct node* list, const char* w){
+    if(p->failed == true){
+        return false;
+    }
+    if(list == NULL || p->pos == p->count || isWord(&p->tokens[p->pos], w) == false){
+        parseError(p);
+        return false;
+    }
+    p->pos++;
+    return true;
+}
+
+static struct node* newNode(struct parser* p, int type){
+    struct node *n = arenaAlloc(p->mem, sizeof(struct node));
+
+    memset(n, 0, sizeof(struct node));
+    n->type = type;
+    return n;
+}
+
+static struct node* parseCommand(struct parser* p);
+
+/*
+Commands separated by ';', '&' or newlines, up to a closing reserved word (left for the
+caller) or, with nothing open, the end of the line
+*/
+static struct node* parseList(struct parser* p){
+    struct node *head = NULL;
+    struct node **link = &head;
+
+    while(p->failed == false){
+        if(p->pos == p->count){
+            if(p->depth == 0 || nextLine(p) == false){
+                break;
+            }
+            continue;
+        }
+        if(p->tokens[p->pos].type == TOKEN_SEMI){               // Empty command
+            parseError(p);
+            break;
+        }
+        if(isClosingWord(&p->tokens[p->pos]) == true){
+            break;
+        }
+        *link = parseCommand(p);
+        if(*link == NULL){
+            p->failed = true;
+            break;
+        }
+        link = &(*link)->next;
+    }
+    return head;
+}
+
+/*
+A pipeline, up to and including its ';' or '&'. Syntax is checked and the text kept now.
+*/
+static struct node* parseSimple(struct parser* p){
+    struct node *n = newNode(p, NODE_COMMAND);
+    int start = p->pos;
+
+    while(p->pos < p->count && p->tokens[p->pos].type != TOKEN_SEMI){
+        if(p->tokens[p->pos++].type == TOKEN_BG){               // '&' ends the command too
+            break;
+        }
+    }
+    n->tokens = &p->tokens[start];
+    n->count = p->pos - start;
+    if(p->pos < p->count && p->tokens[p->pos].type == TOKEN_SEMI){
+        p->pos++;
+    }
+    if(checkTokens(n->tokens, n->count) == false){
+        return NULL;
+    }
+    n->cmdLine = commandText(n->tokens, n->count, p->mem);
+    return n;
+}
+
+/*
+if/elif: the condition, then-list and whatever follows, through the closing "fi"
+*/
+static struct node* parseIf(struct parser* p){
+    struct node *n = newNode(p, NODE_IF);
+
+    p->pos++;                                                   // "if" or "elif"
+    n->cond = parseList(p);
+    if(expectWord(p, n->cond, "then") == false){
+        return NULL;
+    }
+    n->body = parseList(p);
+    if(p->failed == false && n->body != NULL && isWord(&p->tokens[p->pos], "elif") == true){
+        n->orElse = parseIf(p);                                 // Consumes the "fi"
+        return n->orElse != NULL ? n : NULL;
+    }
+    if(p->failed == false && n->body != NULL && isWord(&p->tokens[p->pos], "else") == true){
+        p->pos++;
+        n->orElse = parseList(p);
+        return expectWord(p, n->orElse, "fi") == true ? n : NULL;
+    }
+    return expectWord(p, n->body, "fi") == true ? n : NULL;
+}
+
+/*
+while/until cond; do body; done
+*/
+static struct node* parseLoop(struct parser* p){
+    struct node *n = newNode(p, isWord(&p->tokens[p->pos], "while") == true ? NODE_WHILE : NODE_UNTIL);
+
+    p->pos++;
+    n->cond = parseList(p);
+    if(expectWord(p, n->cond, "do") == false){
+        return NULL;
+    }
+    n->body = parseList(p);
+    return expectWord(p, n->body, "done") == true ? n : NULL;
+}
+
+/*
+for name [in words]; do body; done. The words are terminated now, they are never part of a command.
+*/
+static struct node* parseFor(struct parser* p){
+    struct node *n = newNode(p, NODE_FOR);
+    struct token *tok;
+    int i;
+
+    p->pos++;
+    if(moreTokens(p) == false){
+        return NULL;
+    }
+    tok = &p->tokens[p->pos];
+    if(tok->type != TOKEN_WORD || tok->flags != 0 || isName(tok->start, tok->len) == false){
+        parseError(p);
+        return NULL;
+    }
+    n->name = arenaAlloc(p->mem, tok->len + 1);
+    memcpy(n->name, tok->start, tok->len);
+    n->name[tok->len] = '\0';
+    n->count = -1;                                              // No "in": loop over "$@"
+    p->pos++;
+
+    if(moreTokens(p) == false){
+        return NULL;
+    }
+    if(isWord(&p->tokens[p->pos], "in") == true){
+        n->tokens = &p->tokens[++p->pos];
+        for(n->count = 0; p->pos < p->count && p->tokens[p->pos].type == TOKEN_WORD; p->pos++){
+            n->count++;
+        }
+        if(p->pos < p->count && p->tokens[p->pos].type != TOKEN_SEMI){
+            parseError(p);
+            return NULL;
+        }
+        for(i = 0; i < n->count; i++){
+            n->tokens[i].start[n->tokens[i].len] = '\0';
+        }
+    }
+    if(p->pos < p->count && p->tokens[p->pos].type == TOKEN_SEMI){
+        p->pos++;
+    }
+    if(moreTokens(p) == false){
+        return NULL;
+    }
+    if(isWord(&p->tokens[p->pos], "do") == false){
+        parseError(p);
+        return NULL;
+    }
+    p->pos++;
+    n->body = parseList(p);
+    return expectWord(p, n->body, "done") == true ? n : NULL;
+}
+
+/*
+{ list; }
+*/
+static struct node* parseGroup(struct parser* p){
+    struct node *n = newNode(p, NODE_GROUP);
+
+    p->pos++;
+    n->body = parseList(p);
+    return expectWord(p, n->body, "}") == true ? n : NULL;
+}
+
+/*
+After a compound command: a ';', the end of the line or a closing word may follow
+*/
+static bool endCompound(struct parser* p){
+    if(p->pos == p->count || isClosingWord(&p->tokens[p->pos]) == true){
+        return true;
+    }
+    if(p->tokens[p->pos].type == TOKEN_SEMI){
+        p->pos++;
+        return true;
+    }
+    parseError(p);
+    return false;
+}
+
+/*
+True if the parser is at "name()" or "name ()"
+*/
+static bool isFunctionHeader(struct parser* p){
+    struct token *tok = &p->tokens[p->pos];
+
+    if(tok->type != TOKEN_WORD || tok->flags != 0){
+        return false;
+    }
+    if(tok->len > 2 && memcmp(tok->start + tok->len - 2, "()", 2) == 0){
+        return isName(tok->start, tok->len - 2);
+    }
+    return p->pos + 1 < p->count && isWord(&p->tokens[p->pos + 1], "()") == true && isName(tok->start, tok->len);
+}
+
+/*
+"name() body" or "function name [()] body", the body being any compound command
+*/
+static struct node* parseFunction(struct parser* p){
+    struct node *n = newNode(p, NODE_FUNCTION);
+    struct token *tok;
+    size_t len;
+
+    if(isWord(&p->tokens[p->pos], "function") == true){
+        p->pos++;
+        if(p->pos == p->count){
+            parseError(p);
+            return NULL;
+        }
+    }
+    tok = &p->tokens[p->pos];
+    len = tok->len > 2 && memcmp(tok->start + tok->len - 2, "()", 2) == 0 ? tok->len - 2 : tok->len;
+    if(tok->type != TOKEN_WORD || tok->flags != 0 || isName(tok->start, len) == false){
+        parseError(p);
+        return NULL;
+    }
+    n->name = arenaAlloc(p->mem, len + 1);
+    memcpy(n->name, tok->start, len);
+    n->name[len] = '\0';
+    p->pos++;
+    if(len == tok->len && p->pos < p->count && isWord(&p->tokens[p->pos], "()") == true){
+        p->pos++;
+    }
+
+    p->depth++;                                                 // The body may start on the next line
+    if(moreTokens(p) == true){
+        tok = &p->tokens[p->pos];
+        if(isWord(tok, "{") || isWord(tok, "if") || isWord(tok, "while") || isWord(tok, "until") || isWord(tok, "for")){
+            n->body = parseCommand(p);
+        }
+        else{
+            parseError(p);
+        }
+    }
+    p->depth--;
+    return n->body != NULL ? n : NULL;
+}
+
+/*
+One command: a compound command, a function definition or a pipeline
+*/
+static struct node* parseCommand(struct parser* p){
+    struct token *tok = &p->tokens[p->pos];
+    struct node *n;
+
+    if(isWord(tok, "if") || isWord(tok, "while") || isWord(tok, "until") || isWord(tok, "for") || isWord(tok, "{")){
+        p->depth++;
+        n = isWord(tok, "if") ? parseIf(p) : isWord(tok, "for") ? parseFor(p) : isWord(tok, "{") ? parseGroup(p) : parseLoop(p);
+        p->depth--;
+        return n != NULL && endCompound(p) == true ? n : NULL;
+    }
+    if(isWord(tok, "function") == true || isFunctionHeader(p) == true){
+        return parseFunction(p);
+    }
+    return parseSimple(p);
+}
+
+/*
+Parse a line into a program. The line is copied into mem first, since the tokens point
+into it and running the program terminates words in place. With readMore, lines are read
+from the input until every compound command is closed. NULL for blank lines, comments and
+syntax errors.
+*/
+struct node* parseProgram(const char* line, size_t len, struct arena* mem, bool readMore){
+    struct parser p;
+    struct node *program;
+    char *copy = arenaAlloc(mem, len + 1);
+
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+    memset(&p, 0, sizeof(struct parser));
+    p.mem = mem;
+    p.readMore = readMore;
+    p.tokens = lexLine(copy, mem, &p.count);
+    if(p.tokens == NULL){
+        return NULL;
+    }
+    program = parseList(&p);
+    if(p.failed == false && p.pos < p.count){                   // A closing word with nothing open
+        parseError(&p);
+    }
+    return p.failed == true ? NULL : program;
+}
+
+/*
+Next line of a compound command being read, after a "> " prompt when interactive
+*/
+char* continuationLine(){
+    char *line;
+
+    if(interactive == true){
+        promptText = "> ";
+        if(lineEditing == false){
+            printf("%s", promptText);
+            fflush(stdout);
+        }
+        atPrompt = true;
+    }
+    line = lineEditing == true ? editLine() : readInputLine(&input);
+    atPrompt = false;
+    promptText = ": ";
+    return line;
+}
+
+/*
+FNV-1a of the first len chars of name, as for the PATH cache
+*/
+static unsigned int varHash(const char* name, size_t len){
+    unsigned int hash = 2166136261u;
+    size_t i;
+
+    for(i = 0; i < len; i++){
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+Slot of name in the variable table: its entry, or the empty slot where it would go
+*/
+static size_t varSlot(const char* name, size_t len){
+    size_t mask = varTab.cap - 1;
+    size_t slot;
+
+    for(slot = varHash(name, len) & mask; varTab.entries[slot].name != NULL; slot = (slot + 1) & mask){
+        if(strncmp(varTab.entries[slot].name, name, len) == 0 && varTab.entries[slot].name[len] == '\0'){
+            break;
+        }
+    }
+    return slot;
+}
+
+/*
+Variable named by the first len chars of name, NULL if unset
+*/
+struct variable* varFind(const char* name, size_t len){
+    struct variable *var;
+
+    if(varTab.cap == 0){
+        return NULL;
+    }
+    var = &varTab.entries[varSlot(name, len)];
+    return var->name != NULL ? var : NULL;
+}
+
+/*
+Value of a variable, NULL if unset
+*/
+char* varGet(const char* name){
+    struct variable *var = varFind(name, strlen(name));
+
+    return var != NULL ? var->value : NULL;
+}
+
+/*
+Set a variable, creating it unexported if it is new. Changing PATH drops the PATH cache,
+changing an exported variable makes the next command rebuild the environment.
+*/
+struct variable* varSet(const char* name, const char* value){
+    struct variable *old;
+    struct variable *var;
+    size_t oldCap = varTab.cap;
+    size_t i;
+
+    if((varTab.used + 1) * 2 > varTab.cap){                     // Keep the table at most half full
+        old = varTab.entries;
+        varTab.cap = varTab.cap ? varTab.cap * 2 : 128;
+        varTab.entries = calloc(varTab.cap, sizeof(struct variable));
+        if(varTab.entries == NULL){
+            perror("variables");
+            exit(1);
+        }
+        for(i = 0; i < oldCap; i++){
+            if(old[i].name != NULL){
+                varTab.entries[varSlot(old[i].name, strlen(old[i].name))] = old[i];
+            }
+        }
+        free(old);
+    }
+    var = &varTab.entries[varSlot(name, strlen(name))];
+    if(var->name == NULL){
+        var->name = strdup(name);
+        var->exported = false;
+        varTab.used++;
+    }
+    else{
+        free(var->value);
+    }
+    var->value = strdup(value);
+    if(var->name == NULL || var->value == NULL){
+        perror("variables");
+        exit(1);
+    }
+    if(var->exported == true){
+        varTab.envDirty = true;
+    }
+    if(strcmp(name, "PATH") == 0){
+        clearPathCache();
+    }
+    return var;
+}
+
+/*
+Remove a variable, moving later entries of its probe chain back so lookups still find them
+*/
+void varUnset(const char* name){
+    struct variable *var = varFind(name, strlen(name));
+    size_t mask = varTab.cap - 1;
+    size_t hole;
+    size_t next;
+    size_t home;
+
+    if(var == NULL){
+        return;
+    }
+    if(var->exported == true){
+        varTab.envDirty = true;
+    }
+    if(strcmp(name, "PATH") == 0){
+        clearPathCache();
+    }
+    free(var->name);
+    free(var->value);
+    var->name = NULL;
+    varTab.used--;
+    hole = (size_t)(var - varTab.entries);
+    for(next = (hole + 1) & mask; varTab.entries[next].name != NULL; next = (next + 1) & mask){
+        home = varHash(varTab.entries[next].name, strlen(varTab.entries[next].name)) & mask;
+        if(((next - home) & mask) >= ((next - hole) & mask)){  // Entry may move into the hole without passing its home
+            varTab.entries[hole] = varTab.entries[next];
+            varTab.entries[next].name = NULL;
+            hole = next;
+        }
+    }
+}
+
+/*
+"NAME=value ..." environment for exec, rebuilt only after an exported variable changed
+*/
+char** varEnviron(){
+    size_t count = 0;
+    size_t len;
+    size_t i;
+
+    if(varTab.envDirty == false && varTab.env != NULL){
+        return varTab.env;
+    }
+    if(varTab.env != NULL){
+        for(i = 0; varTab.env[i] != NULL; i++){
+            free(varTab.env[i]);
+        }
+        free(varTab.env);
+    }
+    varTab.env = malloc((varTab.used + 1) * sizeof(char*));
+    if(varTab.env == NULL){
+        perror("variables");
+        exit(1);
+    }
+    for(i = 0; i < varTab.cap; i++){
+        if(varTab.entries[i].name == NULL || varTab.entries[i].exported == false){
+            continue;
+        }
+        len = strlen(varTab.entries[i].name);
+        varTab.env[count] = malloc(len + strlen(varTab.entries[i].value) + 2);
+        if(varTab.env[count] == NULL){
+            perror("variables");
+            exit(1);
+        }
+        sprintf(varTab.env[count++], "%s=%s", varTab.entries[i].name, varTab.entries[i].value);
+    }
+    varTab.env[count] = NULL;
+    varTab.envCount = count;
+    varTab.envDirty = false;
+    return varTab.env;
+}
+
+/*
+Environment for one command: the shared one, or a copy in the line arena with the
+command's own NAME=value prefixes in front of it
+*/
+char** commandEnviron(struct inputAttributes* obj){
+    char **shared = varEnviron();
+    char **env;
+    size_t nameLen;
+    size_t count = 0;
+    size_t i;
+    int k;
+
+    if(obj->assignNum == 0){
+        return shared;
+    }
+    env = arenaAlloc(&lineArena, (varTab.envCount + obj->assignNum + 1) * sizeof(char*));
+    for(k = 0; k < obj->assignNum; k++){
+        env[count++] = obj->assignments[k];
+    }
+    for(i = 0; shared[i] != NULL; i++){                         // Leave out what the prefixes override
+        for(k = 0; k < obj->assignNum; k++){
+            nameLen = (size_t)(strchr(obj->assignments[k], '=') - obj->assignments[k]);
+            if(strncmp(shared[i], obj->assignments[k], nameLen + 1) == 0){
+                break;
+            }
+        }
+        if(k == obj->assignNum){
+            env[count++] = shared[i];
+        }
+    }
+    env[count] = NULL;
+    return env;
+}
+
+/*
+Exit status as $? shows it: the exit code, or 128 + the signal that killed it
+*/
+int lastStatus(){
+    return WIFEXITED(fgVal) ? WEXITSTATUS(fgVal) : 128 + WTERMSIG(fgVal);
+}
+
+/*
+Value a '$' at p expands to. *len is set to the number of chars consumed after the '$'
+(0 when the '$' is just a '$'), the result is NULL for an unset variable.
+*/
+const char* expandDollar(const char* p, const char* end, size_t* len, char* numBuf){
+    const char *name = p;
+    struct variable *var;
+    int i;
+
+    *len = 0;
+    if(p >= end){
+        return "$";
+    }
+    if(*p == '$'){
+        *len = 1;
+        return shellPidText;
+    }
+    if(*p == '?'){
+        *len = 1;
+        sprintf(numBuf, "%d", lastStatus());
+        return numBuf;
+    }
+    if(*p == '#'){
+        *len = 1;
+        sprintf(numBuf, "%d", positionalCount);
+        return numBuf;
+    }
+    if(*p == '@' || *p == '*'){
+        *len = 1;
+        return positionalText();
+    }
+    if(*p >= '0' && *p <= '9'){                                 // $0 ... $9
+        *len = 1;
+        return *p == '0' ? shellName : *p - '0' <= positionalCount ? positional[*p - '1'] : NULL;
+    }
+    if(*p == '{'){
+        for(name = ++p; p < end && *p != '}'; p++);
+        if(p == end || p == name){                              // "${" without a name and '}' stays as typed
+            return "$";
+        }
+        *len = (size_t)(p - name) + 2;
+        if(p - name == 1 && *name == '?'){
+            sprintf(numBuf, "%d", lastStatus());
+            return numBuf;
+        }
+        if(p - name == 1 && *name == '$'){
+            return shellPidText;
+        }
+        if(p - name == 1 && *name == '#'){
+            sprintf(numBuf, "%d", positionalCount);
+            return numBuf;
+        }
+        if(*name >= '0' && *name <= '9'){                       // ${10} and up
+            i = atoi(name);
+            return i == 0 ? shellName : i <= positionalCount ? positional[i - 1] : NULL;
+        }
+        var = varFind(name, (size_t)(p - name));
+        return var != NULL ? var->value : NULL;
+    }
+    if(*p != '_' && (*p < 'A' || *p > 'Z') && (*p < 'a' || *p > 'z')){
+        return "$";
+    }
+    while(p < end && (*p == '_' || (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9'))){
+        p++;
+    }
+    *len = (size_t)(p - name);
+    var = varFind(name, *len);
+    return var != NULL ? var->value : NULL;
+}
+
+/*
+Import the environment the shell was started with, every entry exported
+*/
+void loadVariables(){
+    struct variable *var;
+    char *eq;
+    char **env;
+
+    for(env = environ; *env != NULL; env++){
+        eq = strchr(*env, '=');
+        if(eq == NULL){
+            continue;
+        }
+        *eq = '\0';                                             // Split in place for varSet, then put it back
+        var = varSet(*env, eq + 1);
+        *eq = '=';
+        var->exported = true;
+    }
+    varTab.envDirty = true;
+    sprintf(shellPidText, "%d", (int)getpid());
+}
+
+/*
+A line of NAME=value words only sets shell variables. Its status is that of the last
+"$(...)" in the values, 0 without one.
+*/
+void assignVariables(struct inputAttributes* obj){
+    char *eq;
+    int i;
+
+    for(i = 0; i < obj->assignNum; i++){
+        eq = strchr(obj->assignments[i], '=');
+        *eq = '\0';
+        varSet(obj->assignments[i], eq + 1);
+        *eq = '=';
+    }
+    if(substituted == false){
+        fgVal = 0;
+    }
+}
+
+static int compareVarNames(const void* a, const void* b){
+    return strcmp((*(struct variable* const*)a)->name, (*(struct variable* const*)b)->name);
+}
+
+/*
+"export NAME[=value] ..." passes variables to commands, plain "export" lists them
+*/
+void exportVariables(struct inputAttributes* obj){
+    struct variable **sorted;
+    struct variable *var;
+    char *eq;
+    size_t count = 0;
+    size_t i;
+    int arg;
+
+    if(obj->argNum == 1){
+        sorted = malloc(varTab.used * sizeof(struct variable*) + 1);
+        if(sorted == NULL){
+            perror("export");
+            return;
+        }
+        for(i = 0; i < varTab.cap; i++){
+            if(varTab.entries[i].name != NULL && varTab.entries[i].exported == true){
+                sorted[count++] = &varTab.entries[i];
+            }
+        }
+        qsort(sorted, count, sizeof(struct variable*), compareVarNames);
+        for(i = 0; i < count; i++){
+            printf("export %s=\"%s\"\n", sorted[i]->name, sorted[i]->value);
+        }
+        free(sorted);
+        return;
+    }
+    fgVal = 0;
+    for(arg = 1; arg < obj->argNum; arg++){
+        eq = strchr(obj->arguments[arg], '=');
+        if(eq != NULL){
+            *eq = '\0';                                         // Put back below, the word may be run again
+        }
+        if(obj->arguments[arg][0] == '\0' || strspn(obj->arguments[arg],
+           "_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789") != strlen(obj->arguments[arg]) ||
+           (obj->arguments[arg][0] >= '0' && obj->arguments[arg][0] <= '9')){
+            printf("export: %s: not a valid identifier\n", obj->arguments[arg]);
+            fgVal = 1 << 8;
+            if(eq != NULL){
+                *eq = '=';
+            }
+            continue;
+        }
+        var = varFind(obj->arguments[arg], strlen(obj->arguments[arg]));
+        if(eq != NULL || var == NULL){                          // "export NAME" of an unset name exports ""
+            var = varSet(obj->arguments[arg], eq != NULL ? eq + 1 : "");
+        }
+        if(eq != NULL){
+            *eq = '=';
+        }
+        if(var->exported == false){
+            var->exported = true;
+            varTab.envDirty = true;
+        }
+    }
+}
+
+/*
+"unset NAME ..."
+*/
+void unsetVariables(struct inputAttributes* obj){
+    int arg;
+
+    for(arg = 1; arg < obj->argNum; arg++){
+        varUnset(obj->arguments[arg]);
+    }
+    fgVal = 0;
+}
+
+/*
+True while break, continue, return or an interrupt is cutting the running lists short
+*/
+static bool unwinding(){
+    return breakCount > 0 || continueCount > 0 || returning == true || interrupted == true;
+}
+
+/*
+After one pass of a loop: false if the loop must stop for "break", "return", a deeper
+"continue n" or an interrupt. Every 256 passes events are polled, so Ctrl-C and finished
+jobs are noticed inside a loop that only runs builtins.
+*/
+static bool loopNext(){
+    globReset();                                                // Each pass sees the directories afresh
+    if((++loopPasses & 255) == 0){
+        pollEvents(0);
+    }
+    if(interrupted == true || returning == true){
+        return false;
+    }
+    if(breakCount > 0){
+        breakCount--;
+        return false;
+    }
+    if(continueCount > 0){
+        continueCount--;
+        return continueCount == 0;                              // "continue n" resumes the nth loop out
+    }
+    return true;
+}
+
+/*
+while/until: run the body while the condition's status is 0 (while) or not 0 (until).
+The status is the last body command's, 0 if the body never ran.
+*/
+static void runLoop(struct node* n){
+    int status = 0;
+
+    loopDepth++;
+    while(true){
+        runProgram(n->cond);
+        if(unwinding() == false){
+            if((lastStatus() == 0) != (n->type == NODE_WHILE)){
+                break;
+            }
+            runProgram(n->body);
+            status = fgVal;
+        }
+        if(loopNext() == false){
+            break;
+        }
+    }
+    loopDepth--;
+    if(returning == false){
+        fgVal = status;
+    }
+}
+
+/*
+for: expand the words once, then run the body with the variable set to each field
+*/
+static void runFor(struct node* n){
+    struct inputAttributes words;                               // Only its argument list is used
+    struct arena mem = {NULL, 0};                               // Fields live as long as the loop
+    char **fields = positional;
+    int fieldCount = positionalCount;
+    int status = 0;
+    int cap;
+    int i;
+
+    if(n->count >= 0){
+        memset(&words, 0, sizeof(struct inputAttributes));
+        cap = n->count + 1;
+        words.arguments = arenaAlloc(&mem, cap * sizeof(char*));
+        for(i = 0; i < n->count; i++){
+            addWordFields(&words, &cap, &n->tokens[i], &mem);
+        }
+        fields = words.arguments;
+        fieldCount = words.argNum;
+    }
+
+    loopDepth++;
+    for(i = 0; i < fieldCount; i++){
+        varSet(n->name, fields[i]);
+        runProgram(n->body);
+        status = fgVal;
+        if(loopNext() == false){
+            break;
+        }
+    }
+    loopDepth--;
+    arenaFree(&mem);
+    if(returning == false){
+        fgVal = status;
+    }
+}
+
+/*
+Run a list of commands of a parsed program. Each simple command is expanded into the arena
+of the current call depth, which is reset first, so a loop runs in constant memory.
+*/
+void runProgram(struct node* n){
+    struct inputAttributes *obj;
+    struct arena *mem = &execArenas[callDepth];
+
+    for(; n != NULL && unwinding() == false; n = n->next){
+        switch(n->type){
+            case NODE_COMMAND:
+                arenaReset(mem);
+                obj = parseTokens(n->tokens, n->count, n->cmdLine, mem);
+                runCommand(obj);
+                if(WIFSIGNALED(fgVal) && WTERMSIG(fgVal) == SIGINT){   // Ctrl-C killed it, stop the whole program
+                    interrupted = true;
+                }
+                break;
+
+            case NODE_IF:
+                runProgram(n->cond);
+                if(unwinding() == true){
+                    break;
+                }
+                if(lastStatus() == 0){
+                    runProgram(n->body);
+                }
+                else if(n->orElse != NULL){
+                    runProgram(n->orElse);
+                }
+                else{
+                    fgVal = 0;                                  // No branch ran
+                }
+                break;
+
+            case NODE_WHILE:
+            case NODE_UNTIL:
+                runLoop(n);
+                break;
+
+            case NODE_FOR:
+                runFor(n);
+                break;
+
+            case NODE_GROUP:
+                runProgram(n->body);
+                break;
+
+            case NODE_FUNCTION:
+                defineFunction(n);
+                fgVal = 0;
+                break;
+        }
+    }
+}
+
+/*
+Run a program one call depth down, so it does not reset the arena of the command that
+started it (a "$(...)" being expanded)
+*/
+void runNested(struct node* n){
+    if(callDepth + 1 >= MAXCALLDEPTH){
+        printf("maximum nesting depth exceeded\n");
+        fgVal = 1 << 8;
+        return;
+    }
+    callDepth++;
+    runProgram(n);
+    callDepth--;
+    if(callDepth == 0){
+        arenaFree(&retiredBodies);
+    }
+}
+
+/*
+Slot of name in the function table: its entry, or the empty slot where it would go
+*/
+static size_t funcSlot(const char* name){
+    size_t mask = funcTab.cap - 1;
+    size_t slot;
+
+    for(slot = varHash(name, strlen(name)) & mask; funcTab.entries[slot].name != NULL; slot = (slot + 1) & mask){
+        if(strcmp(funcTab.entries[slot].name, name) == 0){
+            break;
+        }
+    }
+    return slot;
+}
+
+/*
+Function called name, NULL if there is none. Checked for every command, so it costs
+nothing until a function is defined.
+*/
+struct function* findFunction(const char* name){
+    struct function *fn;
+
+    if(funcTab.used == 0){
+        return NULL;
+    }
+    fn = &funcTab.entries[funcSlot(name)];
+    return fn->name != NULL ? fn : NULL;
+}
+
+/*
+Copy a list of nodes and the text their tokens point into, so the list outlives its line
+*/
+static struct node* copyNodes(struct node* n, struct arena* mem){
+    struct node *copy;
+    char *text;
+    size_t span;
+    int i;
+
+    if(n == NULL){
+        return NULL;
+    }
+    copy = arenaAlloc(mem, sizeof(struct node));
+    *copy = *n;
+    if(n->count > 0){                                           // A command's tokens all come from one line
+        span = (size_t)(n->tokens[n->count - 1].start + n->tokens[n->count - 1].len - n->tokens[0].start);
+        text = arenaAlloc(mem, span + 1);
+        memcpy(text, n->tokens[0].start, span);
+        text[span] = '\0';
+        copy->tokens = arenaAlloc(mem, n->count * sizeof(struct token));
+        for(i = 0; i < n->count; i++){
+            copy->tokens[i] = n->tokens[i];
+            copy->tokens[i].start = text + (n->tokens[i].start - n->tokens[0].start);
+        }
+    }
+    if(n->cmdLine != NULL){
+        copy->cmdLine = arenaAlloc(mem, strlen(n->cmdLine) + 1);
+        strcpy(copy->cmdLine, n->cmdLine);
+    }
+    if(n->name != NULL){
+        copy->name = arenaAlloc(mem, strlen(n->name) + 1);
+        strcpy(copy->name, n->name);
+    }
+    copy->cond = copyNodes(n->cond, mem);
+    copy->body = copyNodes(n->body, mem);
+    copy->orElse = copyNodes(n->orElse, mem);
+    copy->next = copyNodes(n->next, mem);
+    return copy;
+}
+
+/*
+Define (or redefine) the function of a NODE_FUNCTION. A replaced body is freed, or kept in
+retiredBodies until the calls return if a function is running, since it could be the one
+being replaced.
+*/
+void defineFunction(struct node* n){
+    struct function *old;
+    struct function *fn;
+    struct arenaBlock *block;
+    size_t oldCap = funcTab.cap;
+    size_t i;
+
+    if((funcTab.used + 1) * 2 > funcTab.cap){                   // Keep the table at most half full
+        old = funcTab.entries;
+        funcTab.cap = funcTab.cap ? funcTab.cap * 2 : 32;
+        funcTab.entries = calloc(funcTab.cap, sizeof(struct function));
+        if(funcTab.entries == NULL){
+            perror("functions");
+            exit(1);
+        }
+        for(i = 0; i < oldCap; i++){
+            if(old[i].name != NULL){
+                funcTab.entries[funcSlot(old[i].name)] = old[i];
+            }
+        }
+        free(old);
+    }
+    fn = &funcTab.entries[funcSlot(n->name)];
+    if(fn->name == NULL){
+        fn->name = strdup(n->name);
+        if(fn->name == NULL){
+            perror("functions");
+            exit(1);
+        }
+        funcTab.used++;
+    }
+    else if(callDepth == 0){
+        arenaFree(&fn->mem);
+    }
+    else if(fn->mem.head != NULL){
+        for(block = fn->mem.head; block->next != NULL; block = block->next);    // Still in use by a running call
+        block->next = retiredBodies.head;
+        retiredBodies.head = fn->mem.head;
+        retiredBodies.total += fn->mem.total;
+        memset(&fn->mem, 0, sizeof(struct arena));
+    }
+    fn->body = copyNodes(n->body, &fn->mem);
+}
+
+/*
+Run a function with the command's arguments as $1 ..., honoring redirections like a builtin.
+break and continue do not reach loops outside of it.
+*/
+void callFunction(struct function* fn, struct inputAttributes* obj){
+    struct node *body = fn->body;                               // fn may move if the body defines functions
+    char **savedArgs = positional;
+    int savedCount = positionalCount;
+    int savedLoops = loopDepth;
+    int saved[MAXREDIRFD];
+
+    if(callDepth + 1 >= MAXCALLDEPTH){
+        printf("%s: maximum function nesting exceeded\n", fn->name);
+        fgVal = 1 << 8;
+        return;
+    }
+    if(redirectShell(obj, saved) == false){
+        fgVal = 1 << 8;
+        return;
+    }
+    positional = obj->arguments + 1;                            // Lives in the caller's arena, untouched one level down
+    positionalCount = obj->argNum - 1;
+    loopDepth = 0;
+    fgVal = 0;
+    fgUsageValid = false;
+
+    callDepth++;
+    runProgram(body);
+    callDepth--;
+    if(callDepth == 0){
+        arenaFree(&retiredBodies);                              // No body is running any more
+    }
+
+    returning = false;
+    positional = savedArgs;
+    positionalCount = savedCount;
+    loopDepth = savedLoops;
+    restoreShell(saved);
+}
+
+/*
+"break [n]" and "continue [n]": leave n loops, continue resumes the last one
+*/
+void loopControl(struct inputAttributes* obj){
+    int levels = obj->arguments[1] != NULL ? atoi(obj->arguments[1]) : 1;
+
+    if(loopDepth == 0){
+        printf("%s: only meaningful in a loop\n", obj->command);
+        fgVal = 1 << 8;
+        return;
+    }
+    if(levels < 1){
+        printf("%s: %s: loop count out of range\n", obj->command, obj->arguments[1]);
+        fgVal = 1 << 8;
+        return;
+    }
+    if(levels > loopDepth){
+        levels = loopDepth;
+    }
+    if(obj->command[0] == 'b'){
+        breakCount = levels;
+    }
+    else{
+        continueCount = levels;
+    }
+    fgVal = 0;
+}
+
+/*
+"return [n]": leave the function with status n, or with the last command's status
+*/
+void returnCommand(struct inputAttributes* obj){
+    if(callDepth == 0){
+        printf("return: can only `return' from a function\n");
+        fgVal = 1 << 8;
+        return;
+    }
+    if(obj->arguments[1] != NULL){
+        fgVal = (atoi(obj->arguments[1]) & 0xff) << 8;
+    }
+    returning = true;
+}
+
+/*
+"shift [n]": drop the first n positional parameters
+*/
+void shiftCommand(struct inputAttributes* obj){
+    int n = obj->arguments[1] != NULL ? atoi(obj->arguments[1]) : 1;
+
+    if(n < 0 || n > positionalCount){
+        printf("shift: %s: shift count out of range\n", obj->arguments[1]);
+        fgVal = 1 << 8;
+        return;
+    }
+    positional += n;
+    positionalCount -= n;
+    fgVal = 0;
+}
+
+/*
+$* and an unsplit $@: the positional parameters joined with spaces
+*/
+const char* positionalText(){
+    int i;
+
+    joinBuf.len = 0;
+    for(i = 0; i < positionalCount; i++){
+        if(i > 0){
+            textAppend(&joinBuf, " ", 1);
+        }
+        textAppend(&joinBuf, positional[i], strlen(positional[i]));
+    }
+    textAppend(&joinBuf, "", 1);                                // Terminated, and allocated even when empty
+    return joinBuf.data;
+}
+
+/*
+Open the files and here-strings of obj's redirections in the parent, so both launch paths
+and commands run in the shell only have to dup them into place. They are opened above the
+fds a redirection can name, so putting one in place never replaces another. Returns -1 and
+prints why if one cannot be set up, nothing is left open then.
+*/
+int openRedirection(struct inputAttributes* obj){
+    struct redirection *r;
+    int targets = 0;                                            // Bit per fd an earlier redirection set up
+    int fd;
+
+    for(r = obj->redirs; r != NULL; r = r->next){
+        if(r->type == REDIR_CLOSE){
+            targets &= ~(1 << r->fd);
+            continue;
+        }
+        if(r->type == REDIR_DUP){                               // Must exist in the shell or be set up above
+            if(r->source < 0 || ((r->source >= MAXREDIRFD || (targets & (1 << r->source)) == 0) &&
+                                 fcntl(r->source, F_GETFD) < 0)){
+                printf("%s: bad file descriptor\n", r->word);
+                closeRedirection(obj);
+                return -1;
+            }
+            targets |= 1 << r->fd;
+            continue;
+        }
+
+        if(r->type == REDIR_IN){
+            fd = open(r->word, O_RDONLY | O_CLOEXEC);
+            if(fd < 0){
+                printf("cannot open %s for input\n", r->word);
+            }
+        }
+        else if(r->type == REDIR_STRING){
+            fd = hereString(r->word);
+        }
+        else{
+            globReset();                                        // May create a file
+            fd = open(r->word, O_WRONLY | O_CREAT | O_CLOEXEC | (r->type == REDIR_APPEND ? O_APPEND : O_TRUNC), 0644);
+            if(fd < 0){
+                printf("cannot open %s for output\n", r->word);
+            }
+        }
+        if(fd < 0){
+            closeRedirection(obj);
+            return -1;
+        }
+        r->source = shellFd(fd);
+        targets |= 1 << r->fd;
+    }
+    return 0;
+}
+
+/*
+Close what openRedirection() opened, once it has been put in place
+*/
+void closeRedirection(struct inputAttributes* obj){
+    struct redirection *r;
+
+    for(r = obj->redirs; r != NULL; r = r->next){
+        if(r->type != REDIR_DUP && r->type != REDIR_CLOSE && r->source >= 0){
+            close(r->source);
+            r->source = -1;
+        }
+    }
+}
+
+/*
+Read end holding a here-string: word and a newline. Up to PIPE_BUF bytes are written into a
+pipe, which takes them without blocking; longer strings go into a memfd instead, so the shell
+never waits for the command to read. Returns -1 after printing the error.
+*/
+int hereString(const char* word){
+    struct iovec parts[2];
+    size_t len = strlen(word);
+    int fds[2];
+
+    parts[0].iov_base = (void*)word;
+    parts[0].iov_len = len;
+    parts[1].iov_base = "\n";
+    parts[1].iov_len = 1;
+    if(len + 1 <= PIPE_BUF){
+        if(pipe2(fds, O_CLOEXEC) < 0){
+            perror("pipe");
+            return -1;
+        }
+        if(writev(fds[1], parts, 2) < 0){
+            perror("here-string");
+        }
+        close(fds[1]);
+        return fds[0];
+    }
+
+    fds[0] = memfd_create("here-string", MFD_CLOEXEC);
+    if(fds[0] < 0){
+        perror("memfd_create");
+        return -1;
+    }
+    if(writev(fds[0], parts, 2) != (ssize_t)(len + 1)){
+        perror("here-string");
+        close(fds[0]);
+        return -1;
+    }
+    lseek(fds[0], 0, SEEK_SET);
+    return fds[0];
+}
+
+/*
+Move a descriptor the shell keeps open above the fds redirections can name, so "cmd 3>file"
+run in the shell cannot replace it. The result is close-on-exec.
+*/
+int shellFd(int fd){
+    int moved;
+
+    if(fd < 0 || fd >= MAXREDIRFD){
+        return fd;
+    }
+    moved = fcntl(fd, F_DUPFD_CLOEXEC, MAXREDIRFD);
+    if(moved < 0){
+        return fd;
+    }
+    close(fd);
+    return moved;
+}
+
+/*
+Add obj's redirections to the file actions of a posix_spawn, in the order written
+*/
+void spawnRedirection(posix_spawn_file_actions_t* actions, struct inputAttributes* obj){
+    struct redirection *r;
+
+    for(r = obj->redirs; r != NULL; r = r->next){
+        if(r->type == REDIR_CLOSE){
+            posix_spawn_file_actions_addclose(actions, r->fd);
+        }
+        else{
+            posix_spawn_file_actions_adddup2(actions, r->source, r->fd);
+        }
+    }
+}
+
+/*
+Put obj's redirections in place in a forked child, in the order written
+*/
+void applyRedirection(struct inputAttributes* obj){
+    struct redirection *r;
+
+    for(r = obj->redirs; r != NULL; r = r->next){
+        if(r->type == REDIR_CLOSE){
+            close(r->fd);
+        }
+        else{
+            dup2(r->source, r->fd);
+        }
+    }
+}
+
+/*
+Lower one rlimit to value in a forked child. Only the soft limit changes, the hard one stays
+as the shell had it, so a job can never get more than the shell was allowed.
+*/
+static bool lowerLimit(int resource, rlim_t value){
+    struct rlimit rl;
+
+    if(getrlimit(resource, &rl) < 0){
+        return false;
+    }
+    if(rl.rlim_max != RLIM_INFINITY && value > rl.rlim_max){
+        errno = EPERM;
+        return false;
+    }
+    rl.rlim_cur = value;
+    return setrlimit(resource, &rl) == 0;
+}
+
+/*
+In a forked child before exec: join the job's cgroup, then take the niceness, CPUs and
+rlimits "nice" and "limit" asked for. Returns false, having said why, if a limit can't be set;
+a niceness that can't be raised only gets a warning, as with nice(1).
+*/
+bool applyLimits(struct jobLimits* limits){
+    if(limits->procsFd >= 0 && write(limits->procsFd, "0", 1) < 0){
+        printf("limit: cannot join the job's cgroup: %s\n", strerror(errno));
+    }
+    if(limits->niceness != 0 && setpriority(PRIO_PROCESS, 0, getpriority(PRIO_PROCESS, 0) + limits->niceness) < 0){
+        printf("nice: cannot set niceness: %s\n", strerror(errno));
+    }
+    if(limits->cpuText != NULL && sched_setaffinity(0, sizeof(cpu_set_t), &limits->cpus) < 0){
+        printf("limit: cpus=%s: %s\n", limits->cpuText, strerror(errno));
+        return false;
+    }
+    if(limits->cpuSeconds != RLIM_INFINITY && lowerLimit(RLIMIT_CPU, limits->cpuSeconds) == false){
+        printf("limit: cpu: %s\n", strerror(errno));
+        return false;
+    }
+    if(limits->memBytes != RLIM_INFINITY && limits->memInCgroup == false && lowerLimit(RLIMIT_AS, limits->memBytes) == false){
+        printf("limit: mem: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/*
+Forget every resolved command, e.g. after "hash -r" or when PATH changed
+*/
+void clearPathCache(){
+    size_t i;
+
+    for(i = 0; i < pathCache.cap; i++){
+        free(pathCache.entries[i].name);
+        free(pathCache.entries[i].path);
+    }
+    free(pathCache.entries);
+    pathCache.entries = NULL;
+    pathCache.cap = 0;
+    pathCache.used = 0;
+}
+
+/*
+Walk PATH for an executable regular file called name. Returns a malloc'd path or NULL.
+*/
+char* searchPath(const char* name){
+    const char *pathVar = varGet("PATH");
+    const char *dir;
+    const char *end;
+    char candidate[MAXCHAR];
+    struct stat info;
+    int len;
+
+    if(pathVar == NULL){
+        pathVar = "/usr/local/bin:/usr/bin:/bin";
+    }
+    for(dir = pathVar; ; dir = end + 1){
+        end = strchr(dir, ':');
+        if(end == NULL){
+            end = dir + strlen(dir);
+        }
+        if(end == dir){                                         // Empty entry means the current dir
+            len = snprintf(candidate, sizeof(candidate), "./%s", name);
+        }
+        else{
+            len = snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(end - dir), dir, name);
+        }
+        if(len < (int)sizeof(candidate) && stat(candidate, &info) == 0 && S_ISREG(info.st_mode) &&
+           access(candidate, X_OK) == 0){
+            return strdup(candidate);
+        }
+        if(*end == '\0'){
+            return NULL;
+        }
+    }
+}
+
+/*
+Path to exec for name. Names with a '/' are used as they are; others come from the cache,
+which varSet() drops whenever PATH changes. refresh forces a new PATH search, for a
+cached path that failed to exec. Returns NULL if not found.
+*/
+char* resolveCommand(const char* name, bool refresh){
+    struct pathEntry *bigger;
+    struct pathEntry *entry;
+    size_t mask;
+    size_t slot;
+    size_t biggerCap;
+    size_t i;
+    unsigned int hash = 2166136261u;
+    const char *c;
+
+    if(strchr(name, '/') != NULL){
+        return (char*)name;
+    }
+    if((pathCache.used + 1) * 2 > pathCache.cap){               // Keep the table at most half full
+        biggerCap = pathCache.cap ? pathCache.cap * 2 : 64;
+        bigger = calloc(biggerCap, sizeof(struct pathEntry));
+        if(bigger == NULL){
+            perror("hash");
+            exit(1);
+        }
+        for(i = 0; i < pathCache.cap; i++){
+            if(pathCache.entries[i].name == NULL){
+                continue;
+            }
+            hash = 2166136261u;
+            for(c = pathCache.entries[i].name; *c != '\0'; c++){
+                hash = (hash ^ (unsigned char)*c) * 16777619u;
+            }
+            for(slot = hash & (biggerCap - 1); bigger[slot].name != NULL; slot = (slot + 1) & (biggerCap - 1)){
+            }
+            bigger[slot] = pathCache.entries[i];
+        }
+        free(pathCache.entries);
+        pathCache.entries = bigger;
+        pathCache.cap = biggerCap;
+    }
+
+    hash = 2166136261u;                                         // FNV-1a of the name
+    for(c = name; *c != '\0'; c++){
+        hash = (hash ^ (unsigned char)*c) * 16777619u;
+    }
+    mask = pathCache.cap - 1;
+    for(slot = hash & mask; pathCache.entries[slot].name != NULL; slot = (slot + 1) & mask){
+        if(strcmp(pathCache.entries[slot].name, name) == 0){
+            break;
+        }
+    }
+    entry = &pathCache.entries[slot];
+
+    if(entry->name != NULL && entry->path != NULL && refresh == false){
+        pathCache.hits++;
+        entry->hits++;
+        return entry->path;
+    }
+    pathCache.misses++;
+    if(entry->name == NULL){
+        entry->name = strdup(name);
+        entry->hits = 0;
+        pathCache.used++;
+    }
+    free(entry->path);
+    entry->path = searchPath(name);
+    if(entry->path != NULL){
+        entry->hits++;
+    }
+    return entry->path;
+}
+
+/*
+"hash" lists the cache and its hit/miss counters, "hash -r" empties it, "hash name ..." resolves names now
+*/
+void hashCommands(struct inputAttributes* obj){
+    size_t i;
+    int arg;
+
+    if(obj->argNum == 1){
+        for(i = 0; i < pathCache.cap; i++){
+            if(pathCache.entries[i].name != NULL && pathCache.entries[i].path != NULL){
+                printf("%lu\t%s\n", pathCache.entries[i].hits, pathCache.entries[i].path);
+            }
+        }
+        printf("hits %lu misses %lu\n", pathCache.hits, pathCache.misses);
+        return;
+    }
+    fgVal = 0;
+    for(arg = 1; arg < obj->argNum; arg++){
+        if(strcmp(obj->arguments[arg], "-r") == 0){
+            clearPathCache();
+        }
+        else if(resolveCommand(obj->arguments[arg], true) == NULL){
+            printf("hash: %s: not found\n", obj->arguments[arg]);
+            fgVal = 1 << 8;
+        }
+    }
+}
+
+/*
+Monotonic clock in nanoseconds
+*/
+long long nowNs(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+Start obj->command without waiting for it. argv and redirections are prepared here in the
+parent; LAUNCH_SPAWN passes them to posix_spawn as file actions, LAUNCH_FORK is the old
+fork + exec path, also taken for a command under "nice" or "limit" since only a forked
+child can apply those before exec. pipeIn/pipeOut (-1 if unused) connect pipeline stages and errFd (-1 if
+unused) is the stderr of a captured job; redirections are applied after them so they win,
+and "2>&1" joins the pipe. With job control the child joins the process group of job j, or starts
+its own if j has none yet, and takes the terminal if takeTerminal is set. Returns the
+child pid, or -1 if nothing was started.
+*/
+pid_t launchCommand(struct inputAttributes* obj, int pipeIn, int pipeOut, int errFd, struct job* j, bool takeTerminal){
+    char **argList = obj->arguments;                                    // Expanded by the parser, ready for exec
+    char **env;                                                         // Environment, with the command's NAME=value prefixes
+    pid_t pgid = j->pid;                                                // 0 for the first stage
+    int mode = obj->limits != NULL ? LAUNCH_FORK : launchMode;          // posix_spawn can't set rlimits or a cgroup in the child
+    int execPipe[2] = {-1, -1};                                         // Closed by exec, tells a tracing parent the child got there
+    int execErr;
+    long long execNs = 0;
+    pid_t pid = -1;
+    long long start;
+    long long elapsed;
+    int err;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t noSignals;
+    char *path;                                                         // Absolute path to exec
+
+    if(obj->command == NULL){                                           // Stage of assignments only, nothing to run
+        return -1;
+    }
+    if(openRedirection(obj) < 0){
+        return -1;
+    }
+    path = resolveCommand(obj->command, false);                         // Cached PATH lookup, no failed execs in the child
+    if(path == NULL){
+        printf("%s: no such file or directory\n", obj->command);
+        closeRedirection(obj);
+        return -1;
+    }
+    env = commandEnviron(obj);
+    globReset();                                                        // The command may change any directory
+    fflush(stdout);                                                     // Don't let the child inherit a pending prompt
+
+    start = nowNs();
+    if(mode == LAUNCH_SPAWN){
+        posix_spawn_file_actions_init(&actions);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+        if(takeTerminal == true){                                       // Child takes the terminal before exec, no SIGTTIN race
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+        }
+#endif
+        if(pipeIn >= 0){
+            posix_spawn_file_actions_adddup2(&actions, pipeIn, STDIN_FILENO);
+        }
+        if(pipeOut >= 0){
+            posix_spawn_file_actions_adddup2(&actions, pipeOut, STDOUT_FILENO);
+        }
+        if(errFd >= 0){
+            posix_spawn_file_actions_adddup2(&actions, errFd, STDERR_FILENO);
+        }
+        spawnRedirection(&actions, obj);                                // The child's fds are set up before exec, no helper process
+        sigemptyset(&noSignals);                                        // The shell blocks signals for its signalfd, children must not
+        posix_spawnattr_init(&attr);
+        posix_spawnattr_setsigmask(&attr, &noSignals);
+        posix_spawnattr_setpgroup(&attr, pgid);
+        posix_spawnattr_setflags(&attr, interactive == true ? POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP : POSIX_SPAWN_SETSIGMASK);
+        err = posix_spawn(&pid, path, &actions, &attr, argList, env);
+        if(err == ENOENT && path != obj->command){                      // Cached binary went away, search PATH again
+            path = resolveCommand(obj->command, true);
+            err = path != NULL ? posix_spawn(&pid, path, &actions, &attr, argList, env) : ENOENT;
+        }
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        if(err != 0){
+            printf("%s: %s\n", argList[0], err == E2BIG ? "argument list too long" : "no such file or directory");
+            pid = -1;
+        }
+        execNs = nowNs();                                               // posix_spawn only returns once the exec happened
+    }
+    else{
+        if(traceOn == true && pipe2(execPipe, O_CLOEXEC) < 0){
+            execPipe[0] = -1;
+            execPipe[1] = -1;
+        }
+        pid = fork();
+        switch(pid){
+            // if -1, then an error has occured when forking
+            case -1:
+                printf("error when forking\n");
+                exit(1);
+                break;
+
+            // If 0, then we have a child process
+            case 0:
+                if(interactive == true){
+                    setpgid(0, pgid);
+                }
+                if(takeTerminal == true){
+                    tcsetpgrp(STDIN_FILENO, getpgrp());                 // SIGTTOU is still blocked here
+                }
+                sigemptyset(&noSignals);
+                sigprocmask(SIG_SETMASK, &noSignals, NULL);             // Undo the shell's blocked signals
+                if(obj->limits != NULL && applyLimits(obj->limits) == false){   // Before exec, so the command never runs without them
+                    fflush(stdout);
+                    _exit(1);
+                }
+                if(pipeIn >= 0){
+                    dup2(pipeIn, STDIN_FILENO);                         // Call dup2() for the pipeline's pipes
+                }
+                if(pipeOut >= 0){
+                    dup2(pipeOut, STDOUT_FILENO);
+                }
+                if(errFd >= 0){
+                    dup2(errFd, STDERR_FILENO);
+                }
+                applyRedirection(obj);                                  // Then the command's own redirections, in order
+                execve(path, argList, env);                             // Replace the current process with obj command
+                execErr = errno;
+                if(execPipe[1] >= 0){
+                    write(execPipe[1], &execErr, sizeof(execErr));
+                }
+                printf("%s: %s\n", argList[0], execErr == E2BIG ? "argument list too long" : "no such file or directory");
+                fflush(stdout);
+                _exit(1);                                               // No atexit handlers, they belong to the shell
+                break;
+        }
+        if(execPipe[0] >= 0){                                           // EOF once the exec closed the write end
+            close(execPipe[1]);
+            if(read(execPipe[0], &execErr, sizeof(execErr)) == 0){
+                execNs = nowNs();
+            }
+            close(execPipe[0]);
+        }
+    }
+    elapsed = nowNs() - start;
+
+    if(pid > 0 && interactive == true){
+        setpgid(pid, pgid != 0 ? pgid : pid);                           // Also from the parent, so the group exists before the next stage
+        if(takeTerminal == true){
+            tcsetpgrp(STDIN_FILENO, pgid != 0 ? pgid : pid);
+        }
+    }
+    if(pid > 0){
+        traceEvent(TRACE_SPAWN, start, pid, j, 0, obj);
+        if(execNs != 0){
+            traceEvent(TRACE_EXEC, execNs, pid, j, 0, NULL);
+        }
+        launchStat[mode].count++;
+        launchStat[mode].totalNs += elapsed;
+        if(elapsed > launchStat[mode].maxNs){
+            launchStat[mode].maxNs = elapsed;
+        }
+    }
+    closeRedirection(obj);                                              // Pipe ends belong to launchPipeline()
+    return pid;
+}
+
+/*
+Start every stage of a pipeline at once in one process group, each stage's stdout
+feeding the next stage's stdin through a pipe. j is a queued job to start, NULL makes
+a new one. outFd, if not -1, is the last stage's stdout; under "set -o capture" a
+background job's stdout and stderr go to its output ring instead. Returns the job, or
+NULL (and j is gone) if no stage could be started.
+*/
+struct job* launchPipeline(struct inputAttributes* obj, struct job* j, int outFd){
+    bool foreground = j != NULL ? j->foreground : obj->activeBackground == false || runInForeground == true;
+    bool takeTerminal = foreground == true && ttyControl == true;
+    struct inputAttributes *stage;
+    int pipeFds[2];
+    int prevRead = -1;                                                  // Read end feeding the current stage
+    int errFd = -1;                                                     // Write end of the capture pipe
+    pid_t pid;
+
+    if(j == NULL){
+        j = addJob(obj->cmdLine, foreground);
+    }
+    if(obj->limits != NULL){
+        startCgroup(j, obj->limits);                                    // Every stage joins it before exec
+    }
+    if(foreground == false && captureOutput == true && outFd < 0){
+        outFd = startOutput(j);
+        errFd = outFd;
+    }
+    for(stage = obj; stage != NULL; stage = stage->next){
+        pipeFds[0] = -1;
+        pipeFds[1] = stage->next == NULL ? outFd : -1;
+        if(stage->next != NULL){
+            if(pipe2(pipeFds, O_CLOEXEC) < 0){
+                perror("pipe");
+                if(prevRead >= 0){
+                    close(prevRead);
+                }
+                break;
+            }
+            if(pipeSize > 0){
+                fcntl(pipeFds[1], F_SETPIPE_SZ, pipeSize);              // Bigger buffer, fewer context switches between stages
+            }
+        }
+
+        pid = launchCommand(stage, prevRead, pipeFds[1], errFd, j, takeTerminal);
+        addJobProc(j, pid);
+
+        if(prevRead >= 0){
+            close(prevRead);
+        }
+        if(pipeFds[1] >= 0 && pipeFds[1] != outFd){
+            close(pipeFds[1]);
+        }
+        prevRead = pipeFds[0];
+    }
+    if(errFd >= 0){                                                     // Only the stages hold the write end now
+        close(errFd);
+    }
+    if(obj->limits != NULL && obj->limits->procsFd >= 0){
+        close(obj->limits->procsFd);
+        obj->limits->procsFd = -1;
+    }
+
+    if(j->liveCount == 0){
+        removeJob(j);
+        return NULL;
+    }
+    return j;
+}
+
+/*
+Copy count words and the NULL after them into mem
+*/
+static char** copyWords(char** words, int count, struct arena* mem){
+    char **copy = arenaAlloc(mem, (count + 1) * sizeof(char*));
+    int i;
+
+    for(i = 0; i < count; i++){
+        copy[i] = arenaAlloc(mem, strlen(words[i]) + 1);
+        strcpy(copy[i], words[i]);
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+/*
+Copy the expanded stages of a pipeline, with their redirections and limits, into mem so
+they can be launched after the line (and the variables it saw) are gone
+*/
+static struct inputAttributes* copyStages(struct inputAttributes* obj, struct arena* mem){
+    struct inputAttributes *head = NULL;
+    struct inputAttributes **link = &head;
+    struct inputAttributes *copy;
+    struct redirection **redirTail;
+    struct redirection *r;
+    struct jobLimits *limits = NULL;
+
+    if(obj->limits != NULL){                                    // Shared by every stage, as takeLimits() left it
+        limits = arenaAlloc(mem, sizeof(struct jobLimits));
+        *limits = *obj->limits;
+        if(limits->cpuText != NULL){
+            limits->cpuText = arenaAlloc(mem, strlen(obj->limits->cpuText) + 1);
+            strcpy(limits->cpuText, obj->limits->cpuText);
+        }
+    }
+    for(; obj != NULL; obj = obj->next){
+        copy = arenaAlloc(mem, sizeof(struct inputAttributes));
+        *copy = *obj;
+        copy->arguments = copyWords(obj->arguments, obj->argNum, mem);
+        copy->command = obj->command != NULL ? copy->arguments[0] : NULL;
+        copy->assignments = obj->assignments != NULL ? copyWords(obj->assignments, obj->assignNum, mem) : NULL;
+        copy->cmdLine = NULL;                                   // The job has its own
+        copy->limits = limits;
+        redirTail = &copy->redirs;
+        for(r = obj->redirs; r != NULL; r = r->next){
+            *redirTail = arenaAlloc(mem, sizeof(struct redirection));
+            **redirTail = *r;
+            (*redirTail)->word = arenaAlloc(mem, strlen(r->word) + 1);
+            strcpy((*redirTail)->word, r->word);
+            redirTail = &(*redirTail)->next;
+        }
+        *redirTail = NULL;
+        copy->next = NULL;
+        *link = copy;
+        link = &copy->next;
+    }
+    return head;
+}
+
+/*
+Park a background command under "set -j" until a running job ends. Its words are expanded
+already and are kept as they are, so what it runs doesn't depend on when it starts.
+*/
+void queueJob(struct inputAttributes* obj){
+    struct job *j = addJob(obj->cmdLine, false);
+
+    j->stages = copyStages(obj, &j->mem);
+    j->state = JOB_QUEUED;
+    j->cpu = -1;
+    if(jobTab.queueTail != NULL){
+        jobTab.queueTail->nextQueued = j;
+    }
+    else{
+        jobTab.queueHead = j;
+    }
+    jobTab.queueTail = j;
+    jobTab.queued++;
+    printf("background job [%d] queued\n", j->id);
+}
+
+/*
+Take a job out of the scheduler queue
+*/
+void unqueueJob(struct job* j){
+    struct job *prev = NULL;
+    struct job *cur;
+
+    for(cur = jobTab.queueHead; cur != NULL && cur != j; cur = cur->nextQueued){
+        prev = cur;
+    }
+    if(cur == NULL){
+        return;
+    }
+    if(prev != NULL){
+        prev->nextQueued = j->nextQueued;
+    }
+    else{
+        jobTab.queueHead = j->nextQueued;
+    }
+    if(jobTab.queueTail == j){
+        jobTab.queueTail = prev;
+    }
+    j->nextQueued = NULL;
+    jobTab.queued--;
+}
+
+/*
+Before a scheduled job is launched, narrow the shell to the CPU with the fewest scheduled
+jobs, so the children inherit it and start there rather than being moved once they run.
+saved gets the shell's own mask, put back with sched_setaffinity() right after the launch.
+Returns the index in cpuList, -1 if the job is not pinned ("limit cpus=" chose for it).
+*/
+int pinLaunch(struct inputAttributes* obj, cpu_set_t* saved){
+    cpu_set_t set;
+    int best = 0;
+    int i;
+
+    if(spreadCpus == false || (obj->limits != NULL && obj->limits->cpuText != NULL)){
+        return -1;
+    }
+
+    if(cpuList == NULL){                                                // First use: CPUs the shell is allowed on
+        CPU_ZERO(&set);
+        sched_getaffinity(0, sizeof(set), &set);
+        cpuList = malloc(CPU_SETSIZE * sizeof(int));
+        cpuLoad = calloc(CPU_SETSIZE, sizeof(int));
+        if(cpuList == NULL || cpuLoad == NULL){
+            perror("affinity");
+            exit(1);
+        }
+        for(i = 0; i < CPU_SETSIZE; i++){
+            if(CPU_ISSET(i, &set)){
+                cpuList[cpuCount++] = i;
+            }
+        }
+    }
+    if(cpuCount == 0){
+        return -1;
+    }
+    for(i = 1; i < cpuCount; i++){
+        if(cpuLoad[i] < cpuLoad[best]){
+            best = i;
+        }
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpuList[best], &set);
+    if(sched_getaffinity(0, sizeof(*saved), saved) < 0 || sched_setaffinity(0, sizeof(set), &set) < 0){
+        return -1;
+    }
+    return best;
+}
+
+/*
+Count a just started background job against the limit, on the CPU pinLaunch() gave it
+*/
+void startScheduledJob(struct job* j, int cpu){
+    j->scheduled = true;
+    j->cpu = cpu;
+    jobTab.running++;
+    if(cpu >= 0){
+        cpuLoad[cpu]++;
+    }
+}
+
+/*
+Start queued jobs, oldest first, while the limit allows it
+*/
+void startQueuedJobs(){
+    struct job *j;
+    cpu_set_t saved;
+    bool launched;
+    int cpu;
+    int id;
+
+    while(jobTab.queueHead != NULL && (maxJobs == 0 || jobTab.running < maxJobs)){
+        j = jobTab.queueHead;
+        unqueueJob(j);
+        j->state = JOB_RUNNING;
+        j->startNs = nowNs();
+        id = j->id;
+
+        cpu = pinLaunch(j->stages, &saved);
+        launched = launchPipeline(j->stages, j, -1) != NULL;            // Removes j if nothing started
+        if(cpu >= 0){
+            sched_setaffinity(0, sizeof(saved), &saved);
+        }
+        if(launched == true){
+            j->stages = NULL;
+            arenaFree(&j->mem);
+            startScheduledJob(j, cpu);
+            continue;
+        }
+        if(waitTargetId == id){                                         // Failed to start, wake up "wait %n"
+            waitTargetStatus = 1 << 8;
+            waitTargetId = 0;
+        }
+    }
+}
+
+/*
+"kill %n" on a queued job: report it as killed by sig without ever starting it
+*/
+void cancelQueuedJob(struct job* j, int sig){
+    unqueueJob(j);
+    if(j->id == waitTargetId){
+        waitTargetStatus = sig & 0x7f;                                  // Wait status of a process killed by sig
+        waitTargetId = 0;
+    }
+    printf("Queued job [%d] is done: terminated by signal %d\n", j->id, sig);
+    removeJob(j);
+}
+
+/*
+A scheduled job ended, give its slot (and CPU) to the next queued job
+*/
+void finishScheduledJob(struct job* j){
+    if(j->scheduled == false){
+        return;
+    }
+    j->scheduled = false;
+    jobTab.running--;
+    if(j->cpu >= 0){
+        cpuLoad[j->cpu]--;
+        j->cpu = -1;
+    }
+}
+
+/*
+"set -o pipefail" / "set +o pipefail" picks the pipeline status, "set -P bytes" sizes pipeline pipes,
+"set -j [N]" / "set +j" limits how many background jobs run at once (N defaults to the online CPUs),
+"set -o affinity" spreads those jobs over the CPUs and "set -o capture" keeps their output in the shell
+*/
+void setOptions(struct inputAttributes* obj){
+    int testPipe[2];
+    int i;
+
+    if(obj->argNum == 1){
+        printf("pipefail %s\n", pipeFail == true ? "on" : "off");
+        printf("pipe size %d\n", pipeSize);
+        printf("max jobs %d (%d running, %d queued)\n", maxJobs, jobTab.running, jobTab.queued);
+        printf("affinity %s\n", spreadCpus == true ? "on" : "off");
+        printf("capture %s\n", captureOutput == true ? "on" : "off");
+        return;
+    }
+    for(i = 1; i < obj->argNum; i++){
+        if((strcmp(obj->arguments[i], "-o") == 0 || strcmp(obj->arguments[i], "+o") == 0) &&
+           obj->arguments[i + 1] != NULL && strcmp(obj->arguments[i + 1], "pipefail") == 0){
+            pipeFail = obj->arguments[i][0] == '-';
+            i++;
+        }
+        else if((strcmp(obj->arguments[i], "-o") == 0 || strcmp(obj->arguments[i], "+o") == 0) &&
+                obj->arguments[i + 1] != NULL && strcmp(obj->arguments[i + 1], "affinity") == 0){
+            spreadCpus = obj->arguments[i][0] == '-';              // Applies to jobs started from now on
+            i++;
+        }
+        else if((strcmp(obj->arguments[i], "-o") == 0 || strcmp(obj->arguments[i], "+o") == 0) &&
+                obj->arguments[i + 1] != NULL && strcmp(obj->arguments[i + 1], "capture") == 0){
+            captureOutput = obj->arguments[i][0] == '-';           // Jobs started from now on, "jobs -o %n" shows it
+            i++;
+        }
+        else if(strcmp(obj->arguments[i], "-j") == 0){
+            if(obj->arguments[i + 1] != NULL && obj->arguments[i + 1][0] >= '0' && obj->arguments[i + 1][0] <= '9'){
+                maxJobs = atoi(obj->arguments[++i]);
+            }
+            else{
+                maxJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            }
+            startQueuedJobs();                                      // A higher limit frees slots right away
+        }
+        else if(strcmp(obj->arguments[i], "+j") == 0){
+            maxJobs = 0;
+            startQueuedJobs();
+        }
+        else if(strcmp(obj->arguments[i], "-P") == 0 && obj->arguments[i + 1] != NULL){
+            pipeSize = atoi(obj->arguments[++i]);
+            if(pipeSize > 0 && pipe2(testPipe, O_CLOEXEC) == 0){    // Tell the user now if the kernel won't allow it
+                if(fcntl(testPipe[1], F_SETPIPE_SZ, pipeSize) < 0){
+                    printf("set: pipe size %d: %s\n", pipeSize, strerror(errno));
+                    pipeSize = 0;
+                }
+                close(testPipe[0]);
+                close(testPipe[1]);
+            }
+        }
+        else{
+            printf("usage: set [-o|+o pipefail|affinity|capture] [-P bytes] [-j [N]|+j]\n");
+            fgVal = 1 << 8;
+            return;
+        }
+    }
+}
+
+/*
+"launch" prints the launch mode and spawn latency, "launch spawn" / "launch fork" switches it
+*/
+void launchSettings(struct inputAttributes* obj){
+    const char *modeNames[2] = {"spawn", "fork"};
+    char *mode = obj->arguments[1];
+    int i;
+
+    if(mode == NULL){
+        printf("launch mode: %s\n", modeNames[launchMode]);
+        for(i = 0; i < 2; i++){
+            if(launchStat[i].count == 0){
+                printf("%s: 0 launches\n", modeNames[i]);
+                continue;
+            }
+            printf("%s: %lu launches, avg %lld us, max %lld us\n", modeNames[i], launchStat[i].count,
+                   launchStat[i].totalNs / (long long)launchStat[i].count / 1000, launchStat[i].maxNs / 1000);
+        }
+    }
+    else if(strcmp(mode, "spawn") == 0){
+        launchMode = LAUNCH_SPAWN;
+    }
+    else if(strcmp(mode, "fork") == 0){
+        launchMode = LAUNCH_FORK;
+    }
+    else{
+        printf("launch: unknown mode %s\n", mode);
+    }
+}
+
+/*
+Fork off child process
+*/
+void forkOff(struct inputAttributes* obj){
+    bool background = obj->activeBackground == true && runInForeground == false;
+    struct job *j;
+    cpu_set_t saved;
+    int cpu = -1;
+
+    if(background == true && maxJobs > 0 && (jobTab.running >= maxJobs || jobTab.queueHead != NULL)){
+        queueJob(obj);                                                          // Over the "set -j" limit, run it later
+        return;
+    }
+    if(background == true && maxJobs > 0){
+        cpu = pinLaunch(obj, &saved);
+    }
+    j = launchPipeline(obj, NULL, -1);
+    if(cpu >= 0){
+        sched_setaffinity(0, sizeof(saved), &saved);                            // The shell itself runs anywhere again
+    }
+    if(j == NULL){                                                              // Nothing started, report it like a failed child
+        if(obj->activeBackground == false || runInForeground == true){
+            fgVal = 1 << 8;
+        }
+        return;
+    }
+
+    if(j->foreground == false){                                                 // If in bg mode
+        if(maxJobs > 0){
+            startScheduledJob(j, cpu);
+        }
+        printf("background pid is %d\n", j->pid);
+    }
+    else{
+        // Wait for the pipeline to end if bg mode not on
+        waitForeground(j);
+    }
+}
+
+/*
+Stop signal to switch back and forth between foreground mode
+*/
+void stopSig(int sig){  
+    (void)sig;
+    if(runInForeground == false){ // If not already in foreground mode
+        char* message = ("\nEntering foreground-only mode (& is now ignored)\n");
+        write(STDOUT_FILENO, message, strlen(message));
+        runInForeground = true;   // Status of foreground mode is switched to on/true
+    }
+    else{
+        // For exiting foreground mode
+        char* message = "\nExiting foreground-only mode\n";
+        write(STDOUT_FILENO, message, strlen(message));
+        runInForeground = false;  // Status of foreground mode is switche back to off/false
+    }
+}
+
+/*
+Handles ending of child process when there are no pidfds to tell us which one ended
+*/
+void childSig(int sig){
+    siginfo_t exited;
+    struct job *j;
+    size_t i;
+    int k;
+
+    (void)sig;
+    updateStoppedJobs();
+    if(unwatchedProcs == 0){                                           // pidfd events already name every child
+        return;
+    }
+    // Look for exited/terminated processes without a pidfd, from the end so removals don't skip entries
+    for(i = jobTab.count; i > 0; i--){
+        j = jobTab.jobs[i - 1];
+        for(k = j->procCount - 1; k >= 0 && i <= jobTab.count && jobTab.jobs[i - 1] == j; k--){
+            if(j->procs[k].pidFd < 0 && j->procs[k].done == false){
+                if(traceOn == true && waitid(P_PID, j->procs[k].pid, &exited, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+                   exited.si_pid != 0){
+                    traceEvent(TRACE_EXIT, 0, j->procs[k].pid, j, 0, NULL);
+                }
+                reapChild(j->procs[k].pid);
+            }
+        }
+    }
+}
+
+/*
+Handles termination of process
+*/
+void terminateSig(int sig){
+    printf("\nterminated by signal %d\n", sig);                         // Outputs signal that terminated process
+}
+
+/*
+Block the signals the shell handles and route them, stdin and child exits through one epoll set
+*/
+void setupEventLoop(){
+    sigset_t mask;
+    struct epoll_event ev;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigaddset(&mask, SIGTTOU);                                          // Lets the shell take the terminal back from a job
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    sigdelset(&mask, SIGTTOU);
+
+    shellPgid = getpgrp();
+    if(interactive == true && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == shellPgid){   // Foreground jobs will be handed the terminal
+        ttyControl = true;
+        tcgetattr(STDIN_FILENO, &shellTermios);
+    }
+
+    epollFd = shellFd(epoll_create1(EPOLL_CLOEXEC));                    // Above the fds "cmd 3>file" may replace
+    signalFd = shellFd(signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC));
+    if(epollFd < 0 || signalFd < 0){
+        perror("event loop");
+        exit(1);
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (unsigned long long)EVENT_SIGNAL << 32;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &ev);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (unsigned long long)EVENT_STDIN << 32;
+    input.pollable = input.fd >= 0 && epoll_ctl(epollFd, EPOLL_CTL_ADD, input.fd, &ev) == 0;   // EPERM for regular files
+}
+
+/*
+Open a pidfd for pid and add it to the event loop. Returns the pidfd, or -1 if pidfds are unavailable
+*/
+int watchChild(pid_t pid){
+    int pidFd;
+    struct epoll_event ev;
+
+    if(pidfdSupported == false){
+        return -1;
+    }
+    pidFd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if(pidFd < 0){
+        if(errno == ENOSYS){
+            pidfdSupported = false;                                     // Fall back to scanning on SIGCHLD
+        }
+        return -1;
+    }
+    pidFd = shellFd(pidFd);                                             // Close-on-exec already, kept clear of redirections
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((unsigned long long)EVENT_CHILD << 32) | (unsigned int)pid;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, pidFd, &ev);
+    return pidFd;
+}
+
+/*
+Remove a pidfd from the event loop and close it
+*/
+void unwatchChild(int pidFd){
+    if(pidFd >= 0){
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, pidFd, NULL);
+        close(pidFd);
+    }
+}
+
+/*
+Wait up to timeoutMs (-1 forever) and dispatch signals and child exits.
+Returns true if stdin has input to read.
+*/
+bool pollEvents(int timeoutMs){
+    struct epoll_event events[64];
+    struct signalfd_siginfo info;
+    struct job *j;
+    bool stdinReady = false;
+    int count;
+    int i;
+
+    count = epoll_wait(epollFd, events, 64, timeoutMs);
+    for(i = 0; i < count; i++){
+        switch(events[i].data.u64 >> 32){
+            case EVENT_STDIN:
+                stdinReady = true;
+                break;
+
+            case EVENT_SIGNAL:
+                while(read(signalFd, &info, sizeof(info)) == sizeof(info)){
+                    if(info.ssi_signo == SIGTSTP){
+                        stopSig(SIGTSTP);
+                    }
+                    else if(info.ssi_signo == SIGINT){
+                        terminateSig(SIGINT);
+                        interrupted = true;                             // A running loop stops
+                        if(interactive == false){                       // An interrupted script stops here
+                            killBgProcess();
+                            exit(128 + SIGINT);
+                        }
+                    }
+                    else{
+                        childSig(SIGCHLD);
+                    }
+                    if(atPrompt == true && info.ssi_signo != SIGCHLD){   // Show the prompt again under the message
+                        redrawPrompt();
+                    }
+                }
+                break;
+
+            case EVENT_LISTEN:
+                acceptClients();
+                break;
+
+            case EVENT_CLIENT:                                          // Served by serve(), never from inside a running command
+                if(pendingCount == pendingCap){
+                    pendingCap = pendingCap ? pendingCap * 2 : 16;
+                    pendingClients = realloc(pendingClients, pendingCap * sizeof(int));
+                    if(pendingClients == NULL){
+                        perror("server");
+                        exit(1);
+                    }
+                }
+                pendingClients[pendingCount++] = (int)(events[i].data.u64 & 0xffffffffu);
+                break;
+
+            case EVENT_OUTPUT:
+                j = indexGet(&jobTab.byId, (int)(events[i].data.u64 & 0xffffffffu));
+                if(j != NULL && j->output != NULL){
+                    readOutput(j->output);
+                }
+                break;
+
+            case EVENT_CHILD:
+                if(traceOn == true){
+                    traceEvent(TRACE_EXIT, 0, (pid_t)(events[i].data.u64 & 0xffffffffu),
+                               indexGet(&jobTab.byPid, (pid_t)(events[i].data.u64 & 0xffffffffu)), 0, NULL);
+                }
+                reapChild((pid_t)(events[i].data.u64 & 0xffffffffu));
+                break;
+        }
+    }
+    if(jobTab.queueHead != NULL){                                       // Reaped jobs may have freed "set -j" slots
+        startQueuedJobs();
+    }
+    return stdinReady;
+}
+
+/*
+Collect an exited child; the foreground child updates status, background children are announced
+*/
+void reapChild(pid_t pid){
+    struct job *j;
+    struct jobProc *proc = NULL;
+    struct rusage ru;
+    int cStatus;
+    int i;
+
+    j = indexGet(&jobTab.byPid, pid);
+    if(j == NULL || wait4(pid, &cStatus, WNOHANG, &ru) <= 0){           // Not ours, or still running
+        return;
+    }
+    addUsage(&j->usage.ru, &ru);
+    traceEvent(TRACE_REAP, 0, pid, j, WIFEXITED(cStatus) ? WEXITSTATUS(cStatus) : 128 + WTERMSIG(cStatus), NULL);
+    for(i = 0; i < j->procCount; i++){
+        if(j->procs[i].pid == pid){
+            proc = &j->procs[i];
+        }
+    }
+    proc->status = cStatus;
+    proc->done = true;
+    if(proc->pidFd < 0){
+        unwatchedProcs--;
+    }
+    unwatchChild(proc->pidFd);
+    proc->pidFd = -1;
+    if(--j->liveCount > 0){                                             // Rest of the pipeline still running
+        return;
+    }
+
+    /* 
+    Whole pipeline ended: its status is the last stage's, or with pipefail the last failing one
+    */
+    j->state = JOB_DONE;
+    j->usage.wallNs = nowNs() - j->startNs;
+    finishScheduledJob(j);
+    j->status = j->procs[j->procCount - 1].status;
+    if(pipeFail == true){
+        for(i = 0; i < j->procCount; i++){
+            if(j->procs[i].status != 0){
+                j->status = j->procs[i].status;
+            }
+        }
+    }
+    if(j->output != NULL){                                              // What it wrote last, before the notice
+        readOutput(j->output);
+    }
+    if(j->foreground == true){                                          // waitForeground() takes it from here
+        return;
+    }
+    if(j->id == waitTargetId){                                          // The wait builtin is blocked on this job
+        waitTargetStatus = j->status;
+        waitTargetId = 0;
+        fgUsage = j->usage;
+        fgUsageValid = true;
+    }
+    if(j->client >= 0){                                                 // A control socket client gets the status instead of a notice
+        replyClient(j->client, j->status, &j->usage);
+        removeJob(j);
+        return;
+    }
+    reportBgDone(j);
+    removeJob(j);                                                       // Removes child's job from the table
+}
+
+/*
+Add the usage of one reaped process to a job's total
+*/
+void addUsage(struct rusage* total, const struct rusage* ru){
+    timeradd(&total->ru_utime, &ru->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &ru->ru_stime, &total->ru_stime);
+    if(ru->ru_maxrss > total->ru_maxrss){                               // Stages run side by side, keep the biggest
+        total->ru_maxrss = ru->ru_maxrss;
+    }
+    total->ru_nvcsw += ru->ru_nvcsw;
+    total->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/*
+"real 1.204s user 0.950s sys 0.031s maxrss 5120kB csw 12/3", context switches as voluntary/involuntary
+*/
+void formatUsage(char* buf, size_t size, const struct jobUsage* usage){
+    snprintf(buf, size, "real %.3fs user %ld.%03lds sys %ld.%03lds maxrss %ldkB csw %ld/%ld",
+             usage->wallNs / 1e9,
+             (long)usage->ru.ru_utime.tv_sec, (long)usage->ru.ru_utime.tv_usec / 1000,
+             (long)usage->ru.ru_stime.tv_sec, (long)usage->ru.ru_stime.tv_usec / 1000,
+             usage->ru.ru_maxrss, usage->ru.ru_nvcsw, usage->ru.ru_nivcsw);
+}
+
+/*
+Print the completion notice for a background job, with what it cost
+*/
+void reportBgDone(struct job* j){
+    char usage[160];
+
+    formatUsage(usage, sizeof(usage), &j->usage);
+    if(WIFEXITED(j->status)){                                           // If process exited
+        printf("\nBackground pid %d is done: exit value %d (%s)\n", j->pid, WEXITSTATUS(j->status), usage);
+    }
+    else{                                                               // If process terminated
+        printf("\nBackground pid %d is done: terminated by signal %d (%s)\n", j->pid, WTERMSIG(j->status), usage);
+    }
+    if(atPrompt == true){
+        redrawPrompt();
+    }
+    fflush(stdout);
+}
+
+/*
+Capture j's output: make its pipe and add the read end to the event loop. Returns the write
+end for the stages' stdout and stderr, or -1 to leave them on the terminal.
+*/
+int startOutput(struct job* j){
+    struct epoll_event ev;
+    int fds[2];
+
+    if(pipe2(fds, O_CLOEXEC) < 0){
+        perror("capture");
+        return -1;
+    }
+    j->output = calloc(1, sizeof(struct jobOutput));
+    if(j->output == NULL){
+        perror("capture");
+        exit(1);
+    }
+    j->output->fd = shellFd(fds[0]);
+    fcntl(j->output->fd, F_SETFL, O_NONBLOCK);                          // Only the shell's end, writers still block
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((unsigned long long)EVENT_OUTPUT << 32) | (unsigned int)j->id;   // Background jobs have their id already
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, j->output->fd, &ev);
+    return fds[1];
+}
+
+/*
+Move what a captured job wrote from its pipe into the ring, straight from the kernel into
+place with readv. Once the ring is full the oldest bytes are overwritten. Reads at most one
+ring's worth per call, so a job that never stops writing cannot hold up the shell.
+*/
+void readOutput(struct jobOutput* out){
+    struct iovec parts[2];
+    size_t pos;
+    size_t got = 0;
+    ssize_t n;
+
+    if(out->fd < 0){
+        return;
+    }
+    if(out->ring == NULL){
+        out->ring = malloc(OUTPUT_RING);
+        if(out->ring == NULL){
+            perror("capture");
+            exit(1);
+        }
+    }
+    do{
+        pos = (size_t)(out->total & (OUTPUT_RING - 1));
+        parts[0].iov_base = out->ring + pos;                            // Up to the end of the ring, then from its start
+        parts[0].iov_len = OUTPUT_RING - pos;
+        parts[1].iov_base = out->ring;
+        parts[1].iov_len = pos;
+        n = readv(out->fd, parts, 2);
+        if(n > 0){
+            out->total += (unsigned long long)n;
+            got += (size_t)n;
+        }
+    } while(n > 0 && got < OUTPUT_RING);
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)){        // Every writer is gone
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, out->fd, NULL);
+        close(out->fd);
+        out->fd = -1;
+    }
+}
+
+/*
+A captured job is leaving the table: stop reading its pipe and keep its output with the
+last MAXDONEOUTPUT ones, dropping the oldest
+*/
+void keepOutput(struct job* j){
+    struct jobOutput *out = j->output;
+    struct jobOutput **slot = &doneOutputs[doneOutputCount++ % MAXDONEOUTPUT];
+
+    if(out->fd >= 0){                                                   // Left to anything the job started in the background
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, out->fd, NULL);
+        close(out->fd);
+        out->fd = -1;
+    }
+    if(out->total == 0){                                                // Silent job, keep the entry but not the ring
+        free(out->ring);
+        out->ring = NULL;
+    }
+    out->jobId = j->id;
+    out->pid = j->pid;
+    out->cmdLine = j->cmdLine;                                          // Taken over, removeJob() frees NULL
+    j->cmdLine = NULL;
+    j->output = NULL;
+    if(*slot != NULL){
+        free((*slot)->ring);
+        free((*slot)->cmdLine);
+        free(*slot);
+    }
+    *slot = out;
+}
+
+/*
+"jobs -o %n" or "jobs -o pid" prints what a captured job wrote, the newest OUTPUT_RING bytes
+of it. Jobs still running show their output so far; ended ones are found among the last
+MAXDONEOUTPUT, newest first, since job numbers are reused.
+*/
+void showOutput(struct inputAttributes* obj){
+    const char *spec = obj->arguments[2];
+    struct jobOutput *out = NULL;
+    struct job *j;
+    unsigned int i;
+    size_t kept;
+    size_t start;
+    int key;
+
+    if(spec == NULL){
+        printf("usage: jobs -o %%n|pid\n");
+        fgVal = 1 << 8;
+        return;
+    }
+    j = findJob(spec);
+    if(j != NULL){
+        out = j->output;
+        if(out != NULL){
+            readOutput(out);                                            // Up to date with what is in the pipe
+        }
+    }
+    else{
+        key = atoi(spec[0] == '%' ? spec + 1 : spec);
+        for(i = doneOutputCount; i > 0 && doneOutputCount - i < MAXDONEOUTPUT; i--){
+            out = doneOutputs[(i - 1) % MAXDONEOUTPUT];
+            if((spec[0] == '%' ? out->jobId : out->pid) == key){
+                break;
+            }
+            out = NULL;
+        }
+    }
+    if(out == NULL){
+        printf("jobs: %s: no captured output\n", spec);
+        fgVal = 1 << 8;
+        return;
+    }
+
+    kept = out->total < OUTPUT_RING ? (size_t)out->total : OUTPUT_RING;
+    start = (size_t)((out->total - kept) & (OUTPUT_RING - 1));
+    if(out->total > OUTPUT_RING){
+        printf("[%llu earlier bytes dropped]\n", out->total - OUTPUT_RING);
+    }
+    if(kept > 0){
+        fwrite(out->ring + start, 1, kept < OUTPUT_RING - start ? kept : OUTPUT_RING - start, stdout);
+        if(start + kept > OUTPUT_RING){                                 // Wrapped around
+            fwrite(out->ring, 1, start + kept - OUTPUT_RING, stdout);
+        }
+    }
+    fgVal = 0;
+}
+
+/*
+-s: listen for clients on a SOCK_SEQPACKET socket at path, one message per command line.
+A socket left behind by a shell that is gone is replaced, a live one is not.
+*/
+void startServer(const char* path){
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    struct stat info;
+    sigset_t pipeSignal;
+    int probe;
+
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "%s: socket path too long\n", path);
+        exit(1);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if(stat(path, &info) == 0 && S_ISSOCK(info.st_mode)){
+        probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if(probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0){
+            fprintf(stderr, "%s: a shell is already serving it\n", path);
+            exit(1);
+        }
+        close(probe);
+        unlink(path);
+    }
+    listenFd = shellFd(socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if(listenFd < 0 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, SOMAXCONN) < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    serverPath = path;
+    atexit(stopServer);
+
+    sigemptyset(&pipeSignal);                                           // A client that went away is an EPIPE, not the end of the shell
+    sigaddset(&pipeSignal, SIGPIPE);
+    sigprocmask(SIG_BLOCK, &pipeSignal, NULL);
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = (unsigned long long)EVENT_LISTEN << 32;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+}
+
+/*
+Remove the control socket when the shell exits
+*/
+void stopServer(){
+    if(serverPath != NULL){
+        unlink(serverPath);
+        serverPath = NULL;
+    }
+}
+
+/*
+The server's main loop. Lines that arrive while a command runs in the shell wait in
+pendingClients, so serving one never starts inside another.
+*/
+void serve(){
+    size_t i;
+
+    while(true){
+        pollEvents(-1);
+        for(i = 0; i < pendingCount; i++){                              // Serving may queue more, they are run too
+            serveClient(pendingClients[i]);
+        }
+        pendingCount = 0;
+    }
+}
+
+/*
+Take every waiting connection. Each one is polled one-shot, and armed again once its
+command line has been answered.
+*/
+void acceptClients(){
+    struct epoll_event ev;
+    int fd;
+
+    while((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+        fd = shellFd(fd);
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = ((unsigned long long)EVENT_CLIENT << 32) | (unsigned int)fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+/*
+Whether a client's line returns at once, so it can run inside the server and its changes
+stay for later clients: NAME=value, a function definition, echo and the other in-process
+builtins, and shell commands such as cd, set or jobs. "wait", "time", "nice" and "limit" can
+block, as can functions, loops, lists and "$(...)", which is why obj is NULL for a line with one.
+*/
+static bool servesInline(struct node* program, struct inputAttributes* obj){
+    if(program->next != NULL){
+        return false;
+    }
+    if(program->type == NODE_FUNCTION){
+        return true;
+    }
+    if(obj == NULL || obj->next != NULL){
+        return false;
+    }
+    if(obj->command == NULL){
+        return true;
+    }
+    if(findFunction(obj->command) != NULL){
+        return false;
+    }
+    if(findBuiltin(obj->command) != NULL){
+        return true;
+    }
+    return isShellCommand(obj->command) == true && strcmp(obj->command, "wait") != 0 && strcmp(obj->command, "time") != 0 &&
+           strcmp(obj->command, "nice") != 0 && strcmp(obj->command, "limit") != 0;
+}
+
+/*
+Run the command line a client sent, with the stdin, stdout and stderr that came with it
+(SCM_RIGHTS) in place of the shell's own. Lines that return at once (see servesInline())
+run in the shell and are answered right away. Everything else becomes a job answered when
+it is reaped, so one client's loop never holds up the others: external commands and
+pipelines are launched as usual, the rest runs in a subshell. "exit" is refused, a client
+can't stop the server and the jobs it runs for others.
+*/
+void serveClient(int fd){
+    static char line[SERVER_MSG + 1];
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct inputAttributes *obj = NULL;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec part;
+    struct node *program;
+    struct job *j;
+    char jobLine[MAXCHAR];
+    int stdFds[3] = {-1, -1, -1};
+    int saved[MAXREDIRFD];
+    int received = 0;
+    ssize_t n;
+    pid_t pid;
+    int i;
+
+    memset(&msg, 0, sizeof(msg));
+    part.iov_base = line;
+    part.iov_len = SERVER_MSG;
+    msg.msg_iov = &part;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(stdFds, CMSG_DATA(cmsg), (received < 3 ? received : 3) * sizeof(int));
+            for(i = 3; i < received; i++){                              // More than asked for
+                close(((int*)CMSG_DATA(cmsg))[i]);
+            }
+        }
+    }
+    if(n <= 0){
+        for(i = 0; i < 3; i++){
+            if(stdFds[i] >= 0){
+                close(stdFds[i]);
+            }
+        }
+        if(n < 0 && errno == EAGAIN){                                   // Nothing after all, wait for the line
+            replyClient(fd, -1, NULL);
+            return;
+        }
+        closeClient(fd);                                                // Client hung up
+        return;
+    }
+    if(received != 3 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0){
+        if(stdFds[2] >= 0){
+            dprintf(stdFds[2], "%s\n", received != 3 ? "expected stdin, stdout and stderr with the line" : "command line too long");
+        }
+        for(i = 0; i < 3; i++){
+            if(stdFds[i] >= 0){
+                close(stdFds[i]);
+            }
+        }
+        replyClient(fd, 2 << 8, NULL);
+        return;
+    }
+
+    fflush(stdout);
+    for(i = 0; i < MAXREDIRFD; i++){                                    // Same bookkeeping as redirectShell()
+        saved[i] = -1;
+    }
+    for(i = 0; i < 3; i++){
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, MAXREDIRFD);
+        if(saved[i] < 0){
+            saved[i] = -2;
+        }
+        dup2(stdFds[i], i);
+        close(stdFds[i]);
+    }
+
+    line[n] = '\0';
+    traceEvent(TRACE_READ, 0, 0, NULL, (int)n, NULL);
+    arenaReset(&lineArena);
+    globReset();
+    interrupted = false;
+    program = parseProgram(line, (size_t)n, &lineArena, false);
+    if(program != NULL && program->type == NODE_COMMAND && program->next == NULL && strstr(line, "$(") == NULL){
+        obj = parseTokens(program->tokens, program->count, program->cmdLine, &lineArena);   // "$(...)" is expanded by the subshell
+    }
+    if(program == NULL){                                                // Blank line, comment or syntax error
+        replyClient(fd, strspn(line, " \t\n") == (size_t)n || line[strspn(line, " \t\n")] == '#' ? 0 : 2 << 8, NULL);
+    }
+    else if(obj != NULL && obj->command != NULL && strcmp(obj->command, "exit") == 0){
+        printf("exit: not allowed from a control socket client\n");
+        replyClient(fd, 1 << 8, NULL);
+    }
+    else if(obj != NULL && runsInShell(obj) == false){
+        obj->activeBackground = true;                                   // The shell does not wait for it
+        j = launchPipeline(obj, NULL, STDOUT_FILENO);                   // The client's stdout, never captured
+        if(j != NULL){
+            j->client = fd;
+        }
+        else{
+            replyClient(fd, 1 << 8, NULL);
+        }
+    }
+    else if(servesInline(program, obj) == true){
+        if(obj != NULL){
+            runCommand(obj);                                            // Words are expanded already
+        }
+        else{
+            runProgram(program);
+        }
+        replyClient(fd, fgVal, fgUsageValid == true ? &fgUsage : NULL);
+    }
+    else{
+        pid = startSubshell();                                          // Takes the client's fds along
+        if(pid == 0){
+            if(obj != NULL){
+                runCommand(obj);
+            }
+            else{
+                runProgram(program);
+            }
+            fflush(stdout);
+            _exit(lastStatus());
+        }
+        if(pid < 0){
+            perror("fork");
+            replyClient(fd, 1 << 8, NULL);
+        }
+        else{
+            snprintf(jobLine, sizeof(jobLine), "%.*s", (int)strcspn(line, "\n"), line);
+            j = addJob(jobLine, false);
+            addJobProc(j, pid);
+            j->client = fd;
+        }
+    }
+    restoreShell(saved);
+}
+
+/*
+Answer a client with "status N" (as $? shows it) and what the command cost, then wait for
+its next line. A status of -1 sends nothing and only waits again.
+*/
+void replyClient(int fd, int status, const struct jobUsage* usage){
+    struct epoll_event ev;
+    char reply[256];
+    int len;
+
+    if(status != -1){
+        len = snprintf(reply, sizeof(reply), "status %d", WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+        if(usage != NULL){
+            reply[len++] = ' ';
+            formatUsage(reply + len, sizeof(reply) - len, usage);
+            len += (int)strlen(reply + len);
+        }
+        if(send(fd, reply, len, MSG_NOSIGNAL) < 0){
+            closeClient(fd);
+            return;
+        }
+    }
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = ((unsigned long long)EVENT_CLIENT << 32) | (unsigned int)fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/*
+Drop a client connection
+*/
+void closeClient(int fd){
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+/*
+-S: send the command line in args, with this process's stdin, stdout and stderr, to the
+shell serving path and exit with its status. "status N ..." replies are only read, the
+command's output went straight to the fds passed.
+*/
+int runClient(const char* path, char** args){
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    struct sockaddr_un addr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec part;
+    struct textBuf line = {NULL, 0, 0};
+    char reply[256];
+    int stdFds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int status;
+    int fd;
+    int i;
+    ssize_t n;
+
+    if(args[0] == NULL || strlen(path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "usage: -S socket command ...\n");
+        return 2;
+    }
+    for(i = 0; args[i] != NULL; i++){                                   // Words are joined, the server parses them
+        if(i > 0){
+            textAppend(&line, " ", 1);
+        }
+        textAppend(&line, args[i], strlen(args[i]));
+    }
+    textAppend(&line, "\n", 1);                                         // Never an empty message, that reads as a hangup
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    part.iov_base = line.data;
+    part.iov_len = line.len;
+    msg.msg_iov = &part;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(stdFds));
+    memcpy(CMSG_DATA(cmsg), stdFds, sizeof(stdFds));
+    if(sendmsg(fd, &msg, 0) < 0){
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    n = recv(fd, reply, sizeof(reply) - 1, 0);
+    if(n <= 0){
+        fprintf(stderr, "%s: no reply\n", path);
+        return 127;
+    }
+    reply[n] = '\0';
+    return sscanf(reply, "status %d", &status) == 1 ? status : 127;
+}
+
+/*
+Set up the line reader: the -c string, a script file (memory-mapped when it is a
+regular file, read in chunks otherwise), or stdin when both are NULL
+*/
+void openInput(struct lineReader* in, const char* script, const char* command){
+    struct stat info;
+    int fd;
+
+    memset(in, 0, sizeof(struct lineReader));
+    in->fd = -1;
+    if(command != NULL){
+        in->buf = strdup(command);
+        in->len = strlen(command);
+        in->eof = true;
+        return;
+    }
+    if(script == NULL){
+        in->fd = STDIN_FILENO;
+        return;
+    }
+
+    fd = shellFd(open(script, O_RDONLY | O_CLOEXEC));
+    if(fd < 0){
+        fprintf(stderr, "cannot open %s: %s\n", script, strerror(errno));
+        exit(127);
+    }
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode)){
+        in->eof = true;
+        in->len = (size_t)info.st_size;
+        if(in->len > 0){
+            in->buf = mmap(NULL, in->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);   // Private, lines are terminated in place
+            if(in->buf == MAP_FAILED){
+                perror(script);
+                exit(127);
+            }
+            madvise(in->buf, in->len, MADV_SEQUENTIAL);
+        }
+        close(fd);
+        return;
+    }
+    in->fd = fd;                                                        // Pipe or device: read it like stdin
+}
+
+/*
+Fetch the next line of input, serving events while the input is idle. The line is
+NUL-terminated in place, has no '\n', and stays valid until the next call. Lines can
+be any length. Returns NULL at end of input.
+*/
+char* readInputLine(struct lineReader* in){
+    char *newline;
+    char *line;
+    char *bigger;
+    ssize_t got;
+
+    if(in->fd < 0){                                                     // Whole input in memory; just reap finished jobs
+        pollEvents(0);
+    }
+    while(true){
+        newline = memchr(in->buf + in->start + in->scanned, '\n', in->len - in->start - in->scanned);
+        if(newline != NULL){
+            *newline = '\0';
+            line = in->buf + in->start;
+            in->start = (size_t)(newline - in->buf) + 1;
+            in->scanned = 0;
+            return line;
+        }
+        in->scanned = in->len - in->start;
+        if(in->eof){
+            if(in->start == in->len){
+                return NULL;
+            }
+            /* 
+            Last line has no '\n'. A mapping may end exactly on a page, so it gets its own copy.
+            */
+            line = arenaAlloc(&lineArena, in->len - in->start + 1);
+            memcpy(line, in->buf + in->start, in->len - in->start);
+            line[in->len - in->start] = '\0';
+            in->start = in->len;
+            in->scanned = 0;
+            return line;
+        }
+
+        if(in->pollable == true){
+            if(pollEvents(-1) == false){                                // Only signals or children, keep waiting
+                continue;
+            }
+        }
+        else{
+            pollEvents(0);                                              // File input is always ready; just drain events
+        }
+        if(in->start > 0){                                              // Move the unfinished line to the front
+            memmove(in->buf, in->buf + in->start, in->len - in->start);
+            in->len -= in->start;
+            in->start = 0;
+        }
+        if(in->len + 1 >= in->cap){                                     // Grow for long lines, no length limit
+            in->cap = in->cap ? in->cap * 2 : 4096;
+            bigger = realloc(in->buf, in->cap);
+            if(bigger == NULL){
+                perror("input");
+                exit(1);
+            }
+            in->buf = bigger;
+        }
+        got = read(in->fd, in->buf + in->len, in->cap - 1 - in->len);
+        if(got > 0){
+            in->len += (size_t)got;
+        }
+        else if(got == 0 || errno != EINTR){
+            in->eof = true;
+        }
+    }
+}
+
+/*
+Open the history file, $HISTFILE or ~/.smallsh_history. An empty HISTFILE turns history off.
+Nothing is read here, entries are mapped and indexed when they are first asked for.
+*/
+void historyOpen(){
+    char *file = varGet("HISTFILE");
+    char *home;
+    char path[PATH_MAX];
+
+    hist.fd = -1;
+    if(file == NULL){
+        home = varGet("HOME");
+        if(home == NULL){
+            return;
+        }
+        snprintf(path, sizeof(path), "%s/.smallsh_history", home);
+        file = path;
+    }
+    if(file[0] == '\0'){
+        return;
+    }
+    hist.fd = shellFd(open(file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600));
+    if(hist.fd < 0){
+        printf("history: %s: %s\n", file, strerror(errno));
+        fflush(stdout);
+    }
+}
+
+/*
+Map what other shells (and this one) appended since the last look. The index is dropped,
+the newest entries changed; it is rebuilt from the end as far as it is needed again.
+*/
+void historySync(){
+    struct stat info;
+    void *map;
+    int statResult;
+
+    if(hist.fd < 0){
+        return;
+    }
+    flock(hist.fd, LOCK_SH);                                            // Appends hold LOCK_EX, so the size ends on a whole entry
+    statResult = fstat(hist.fd, &info);
+    flock(hist.fd, LOCK_UN);
+    if(statResult != 0 || (size_t)info.st_size == hist.mapLen){
+        return;
+    }
+    if(hist.map != NULL && (size_t)info.st_size > hist.mapLen){
+        map = mremap(hist.map, hist.mapLen, (size_t)info.st_size, MREMAP_MAYMOVE);
+    }
+    else{                                                               // First entry, or the file was replaced
+        if(hist.map != NULL){
+            munmap(hist.map, hist.mapLen);
+        }
+        map = info.st_size > 0 ? mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, hist.fd, 0) : MAP_FAILED;
+    }
+    hist.map = map == MAP_FAILED ? NULL : map;
+    hist.mapLen = hist.map != NULL ? (size_t)info.st_size : 0;
+    hist.count = 0;
+    hist.scanPos = hist.mapLen;
+}
+
+/*
+Entry n, 0 being the newest. Returns its text (not NUL terminated) and sets len, or returns
+NULL if the file has fewer entries. Only the entries up to n are ever scanned.
+*/
+const char* historyEntry(size_t n, size_t* len){
+    const char *newline;
+    size_t start;
+    size_t end;
+
+    while(hist.count <= n && hist.scanPos > 0){                         // Index one more entry, going back
+        end = hist.scanPos;
+        if(hist.map[end - 1] == '\n'){
+            end--;
+        }
+        newline = memrchr(hist.map, '\n', end);
+        start = newline != NULL ? (size_t)(newline - hist.map) + 1 : 0;
+        if(hist.count == hist.cap){
+            hist.cap = hist.cap ? hist.cap * 2 : 256;
+            hist.starts = realloc(hist.starts, hist.cap * sizeof(size_t));
+            if(hist.starts == NULL){
+                perror("history");
+                exit(1);
+            }
+        }
+        hist.starts[hist.count++] = start;
+        hist.scanPos = start;
+    }
+    if(n >= hist.count){
+        return NULL;
+    }
+    start = hist.starts[n];
+    end = n == 0 ? hist.mapLen : hist.starts[n - 1];
+    if(end > start && hist.map[end - 1] == '\n'){
+        end--;
+    }
+    *len = end - start;
+    return hist.map + start;
+}
+
+/*
+Append a line to the history file. Blank lines, lines starting with a space and repeats of
+the newest entry are left out. One O_APPEND write under an exclusive lock, so lines from
+shells writing at the same time never mix.
+*/
+void historyAdd(const char* line, size_t len){
+    struct iovec parts[2];
+    const char *newest;
+    size_t newestLen;
+
+    if(hist.fd < 0 || len == 0 || line[0] == ' ' || memchr(line, '\n', len) != NULL){
+        return;
+    }
+    historySync();
+    newest = historyEntry(0, &newestLen);
+    if(newest != NULL && newestLen == len && memcmp(newest, line, len) == 0){
+        return;
+    }
+    parts[0].iov_base = (void*)line;
+    parts[0].iov_len = len;
+    parts[1].iov_base = "\n";
+    parts[1].iov_len = 1;
+    flock(hist.fd, LOCK_EX);
+    if(writev(hist.fd, parts, 2) < 0){
+        printf("history: %s\n", strerror(errno));
+    }
+    flock(hist.fd, LOCK_UN);
+}
+
+/*
+Find the last occurrence of query that ends before offset "before" in the mapped history.
+Scans back a chunk at a time with memmem, so a search costs the bytes between the end of the
+file and the match, not the size of the whole history. Sets hit to the offset of the match.
+*/
+bool historySearch(const char* query, size_t queryLen, size_t before, size_t* hit){
+    const char *found;
+    const char *last;
+    size_t from;
+
+    if(queryLen == 0 || hist.map == NULL){
+        return false;
+    }
+    while(before >= queryLen){
+        from = before > HISTORY_CHUNK + queryLen ? before - HISTORY_CHUNK - queryLen : 0;
+        last = NULL;
+        for(found = memmem(hist.map + from, before - from, query, queryLen); found != NULL;
+            found = memmem(found + 1, (size_t)(hist.map + before - found - 1), query, queryLen)){
+            last = found;                                               // The newest match in the chunk wins
+        }
+        if(last != NULL){
+            *hit = (size_t)(last - hist.map);
+            return true;
+        }
+        if(from == 0){
+            return false;
+        }
+        before = from + queryLen - 1;                                   // A match may straddle the chunk boundary
+    }
+    return false;
+}
+
+/*
+"history [n]" prints the newest n entries (all without n), oldest first
+*/
+void historyCommand(struct inputAttributes* obj){
+    const char *entry;
+    size_t limit = obj->arguments[1] != NULL ? strtoul(obj->arguments[1], NULL, 10) : (size_t)-1;
+    size_t len;
+    size_t n;
+
+    historySync();
+    hist.synced = false;                                                // The index may have been reset under the editor
+    for(n = 0; n < limit && historyEntry(n, &len) != NULL; n++){
+    }
+    while(n > 0){
+        entry = historyEntry(--n, &len);
+        fwrite(entry, 1, len, stdout);
+        putchar('\n');
+    }
+    fflush(stdout);
+}
+
+/*
+Screen columns of UTF-8 text, one per character
+*/
+static size_t textColumns(const char* text, size_t len){
+    size_t cols = 0;
+    size_t i;
+
+    for(i = 0; i < len; i++){
+        if(((unsigned char)text[i] & 0xC0) != 0x80){                    // Continuation bytes take no column
+            cols++;
+        }
+    }
+    return cols;
+}
+
+/*
+Byte offset of the character after/before the one at pos in the edited line
+*/
+static size_t nextChar(size_t pos){
+    if(pos < editor.line.len){
+        pos++;
+    }
+    while(pos < editor.line.len && ((unsigned char)editor.line.data[pos] & 0xC0) == 0x80){
+        pos++;
+    }
+    return pos;
+}
+
+static size_t prevChar(size_t pos){
+    if(pos > 0){
+        pos--;
+    }
+    while(pos > 0 && ((unsigned char)editor.line.data[pos] & 0xC0) == 0x80){
+        pos--;
+    }
+    return pos;
+}
+
+/*
+Insert text at the cursor
+*/
+static void editorInsert(const char* text, size_t len){
+    textAppend(&editor.line, text, len);                                // Makes room at the end
+    memmove(editor.line.data + editor.cursor + len, editor.line.data + editor.cursor,
+            editor.line.len - len - editor.cursor);
+    memcpy(editor.line.data + editor.cursor, text, len);
+    editor.cursor += len;
+}
+
+/*
+Delete the bytes from..to of the line, keeping the cursor on the same text
+*/
+static void editorErase(size_t from, size_t to){
+    memmove(editor.line.data + from, editor.line.data + to, editor.line.len - to);
+    editor.line.len -= to - from;
+    if(editor.cursor >= to){
+        editor.cursor -= to - from;
+    }
+    else if(editor.cursor > from){
+        editor.cursor = from;
+    }
+}
+
+/*
+Replace the line, cursor at its end
+*/
+static void editorSetLine(const char* text, size_t len){
+    editor.line.len = 0;
+    textAppend(&editor.line, text, len);
+    editor.cursor = editor.line.len;
+}
+
+/*
+Up (older) or Down (newer) through the history; the line being typed is kept below the newest entry
+*/
+static void editorHistory(bool older){
+    const char *entry;
+    size_t len;
+
+    if(hist.synced == false){                                           // Once per prompt, so entry numbers stay put
+        historySync();
+        hist.synced = true;
+    }
+    if(older == true){
+        entry = historyEntry(editor.histPos, &len);
+        if(entry == NULL){
+            return;
+        }
+        if(editor.histPos == 0){
+            editor.typed.len = 0;
+            textAppend(&editor.typed, editor.line.data, editor.line.len);
+        }
+        editor.histPos++;
+        editorSetLine(entry, len);
+    }
+    else if(editor.histPos > 0){
+        editor.histPos--;
+        if(editor.histPos == 0){
+            editorSetLine(editor.typed.data, editor.typed.len);
+        }
+        else{
+            entry = historyEntry(editor.histPos - 1, &len);
+            editorSetLine(entry, len);
+        }
+    }
+}
+
+/*
+Show the newest entry matching the Ctrl-R query that ends before "before". With older set,
+entries with the same text as the one shown are skipped.
+*/
+static void editorSearch(size_t before, bool older){
+    const char *newline;
+    size_t hit;
+    size_t start;
+    size_t end;
+    bool found;
+
+    if(editor.query.len == 0){
+        editor.failed = false;
+        editor.matched = false;
+        return;
+    }
+    found = historySearch(editor.query.data, editor.query.len, before, &hit);
+    while(found == true){
+        newline = memrchr(hist.map, '\n', hit);                         // Widen the match to its entry
+        start = newline != NULL ? (size_t)(newline - hist.map) + 1 : 0;
+        newline = memchr(hist.map + hit, '\n', hist.mapLen - hit);
+        end = newline != NULL ? (size_t)(newline - hist.map) : hist.mapLen;
+        if(older == false || end - start != editor.line.len || memcmp(hist.map + start, editor.line.data, end - start) != 0){
+            editor.matched = true;
+            editor.matchStart = start;
+            editor.matchEnd = end;
+            editorSetLine(hist.map + start, end - start);
+            editor.cursor = hit - start;
+            break;
+        }
+        found = historySearch(editor.query.data, editor.query.len, start, &hit);
+    }
+    editor.failed = !found;
+}
+
+/*
+A key during Ctrl-R. Returns false if the search ended and the key still has to be handled
+as usual: Enter runs the match, other control keys edit it.
+*/
+static bool searchKey(unsigned char c){
+    char key = (char)c;
+
+    if(c == 18){                                                        // Ctrl-R: next older match
+        editorSearch(editor.matched == true ? editor.matchStart : hist.mapLen, true);
+        return true;
+    }
+    if(c == 7){                                                         // Ctrl-G: give up, back to the line before
+        editor.searching = false;
+        editorSetLine(editor.saved.data, editor.saved.len);
+        return true;
+    }
+    if(c == 127 || c == 8){                                             // Backspace: shorter query, from the newest entry again
+        while(editor.query.len > 0 && ((unsigned char)editor.query.data[--editor.query.len] & 0xC0) == 0x80){
+        }
+        editor.matched = false;
+        editorSearch(hist.mapLen, false);
+        return true;
+    }
+    if(c >= 0x20){                                                      // Longer query, the entry shown may still match
+        textAppend(&editor.query, &key, 1);
+        if(editor.failed == false){                                     // Nothing held the shorter query either
+            editorSearch(editor.matched == true ? editor.matchEnd : hist.mapLen, false);
+        }
+        return true;
+    }
+    editor.searching = false;
+    return false;
+}
+
+/*
+A complete escape sequence: arrows, Home/End and Delete
+*/
+static void editorEscape(){
+    char final = editor.esc[editor.escLen - 1];
+
+    if(editor.esc[1] == '[' && final == '~'){                           // ESC [ n ~
+        switch(editor.esc[2]){
+            case '1': case '7':
+                final = 'H';
+                break;
+            case '4': case '8':
+                final = 'F';
+                break;
+            case '3':
+                final = 'X';
+                break;
+        }
+    }
+    switch(final){
+        case 'A':
+            editorHistory(true);
+            break;
+        case 'B':
+            editorHistory(false);
+            break;
+        case 'C':
+            editor.cursor = nextChar(editor.cursor);
+            break;
+        case 'D':
+            editor.cursor = prevChar(editor.cursor);
+            break;
+        case 'H':
+            editor.cursor = 0;
+            break;
+        case 'F':
+            editor.cursor = editor.line.len;
+            break;
+        case 'X':                                                       // Delete
+            editorErase(editor.cursor, nextChar(editor.cursor));
+            break;
+    }
+}
 
-        /* 
-        Flushes stdout and stdin; Need to call flush() on stdout after every output so output reaches the screen
-        */
-        fflush(stdout);
-        fflush(stdin);
-
-        /* 
-        Print colon symbol as the prompt
-        */
-        printf(": ");
-        memset(inputBuffer, '\0', sizeof(inputBuffer));
-        fgets(inputBuffer, sizeof(inputBuffer), stdin); // Fetch user input
-        
-        /* 
-        Flushes buffer to reset stdout/stdin
-        */
-        fflush(stdout);
-        fflush(stdin);
+/*
+Handle one byte typed at the prompt. Returns EDIT_MORE, EDIT_DONE or EDIT_EOF.
+*/
+int editorKey(unsigned char c){
+    char key = (char)c;
+    size_t pos;
 
-        /* 
-        For handling special characters and shell commands
-        */
-        if(strncmp(inputBuffer, "exit", 4) == 0){ // Recognizes "exit" command and exits from shell.
-            killBgProcess();
-            exit(0);
-        }
-        if((assignedPid = strstr(inputBuffer, "testdir$$")) != NULL){       // Expand instance of $$ into pid
-            int pidReplacement = (int)getpid();                             // For storing the current pid
-            source = malloc(sizeof(char) * 8);                              // Allocate mem for source
-            dest = malloc(sizeof(char) * 20);                               // Allocate mem for dest
-            strcpy(source, "testdir");                                      // Prep for building name of test dir
-            sprintf(dest, "%s%d", source, pidReplacement);                  // Stores concatenated 'testdir' and pid
-            char* tempString = malloc(sizeof(char) * strlen(inputBuffer));  // Allocate mem for the str
-            *assignedPid = 0;
-            strcpy(tempString, inputBuffer);           
-            sprintf(inputBuffer, "%s%s", tempString, dest);                 // inputBuffer is replaced with the final str
-            free(tempString);                                               // Free up temp string mem
-            tempString = NULL;
-            strtok(inputBuffer, "$");
-        }
-        if(strncmp(inputBuffer, "#", 1) == 0){                              // For ignoring the '#' character when user inputs comment
-            continue;
-        } else if(strncmp(inputBuffer, "\n", 1) == 0){                        // For handling the case where user inputs an empty line
-            continue;
-        } else if(strncmp(inputBuffer, "cd", 2) == 0){                        // Handles directory change
-            changeDirectory(inputBuffer);
-        } else if(strncmp(inputBuffer, "status", 6) == 0){                     // Last foreground exit status
-            if(WEXITSTATUS(fgVal)){
-                fgStatus = WEXITSTATUS(fgVal);                           // See if process has exited
-            } else {
-                fgStatus = WTERMSIG(fgVal);                              // See if process was terminated by signal
-            }
-            printf("exit value %d\n", fgStatus);
-        } else {
-            if(inputBuffer != NULL && strcmp(inputBuffer, "") != 0){
-                /* 
-                Read input
-                */
-                obj = malloc(1 * sizeof(struct inputAttributes)); 
-                parseInputStr(inputBuffer, obj); // Parse input
-                forkOff(obj);                    // handle commands & manage parent/child processes
-                freeInputMem(obj);               // Free input mem
-            } else {
-                continue;                        // Keep looping while true
-            }
+    if(editor.escLen > 0){                                              // Inside ESC [ ... or ESC O ...
+        editor.esc[editor.escLen++] = key;
+        if(editor.escLen == 2 && c != '[' && c != 'O'){                 // Alt-key, not bound
+            editor.escLen = 0;
         }
-    } while(true);
-    return 0;
+        else if(editor.escLen > 2 && c >= 0x40 && c <= 0x7e){
+            editorEscape();
+            editor.escLen = 0;
+        }
+        else if(editor.escLen == (int)sizeof(editor.esc)){              // Too long to be one we know
+            editor.escLen = 0;
+        }
+        return EDIT_MORE;
+    }
+    if(editor.searching == true && searchKey(c) == true){
+        return EDIT_MORE;
+    }
+    switch(c){
+        case '\r':
+        case '\n':
+            return EDIT_DONE;
+        case 1:                                                         // Ctrl-A
+            editor.cursor = 0;
+            break;
+        case 2:                                                         // Ctrl-B
+            editor.cursor = prevChar(editor.cursor);
+            break;
+        case 3:                                                         // Ctrl-C: drop the line
+            write(STDOUT_FILENO, "^C\n", 3);
+            editor.line.len = 0;
+            editor.cursor = 0;
+            editor.histPos = 0;
+            break;
+        case 4:                                                         // Ctrl-D: end of input on an empty line
+            if(editor.line.len == 0){
+                return EDIT_EOF;
+            }
+            editorErase(editor.cursor, nextChar(editor.cursor));
+            break;
+        case 5:                                                         // Ctrl-E
+            editor.cursor = editor.line.len;
+            break;
+        case 6:                                                         // Ctrl-F
+            editor.cursor = nextChar(editor.cursor);
+            break;
+        case 8:
+        case 127:                                                       // Backspace
+            editorErase(prevChar(editor.cursor), editor.cursor);
+            break;
+        case 11:                                                        // Ctrl-K: cut to the end
+            editor.line.len = editor.cursor;
+            break;
+        case 12:                                                        // Ctrl-L: clear the screen
+            write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7);
+            break;
+        case 14:                                                        // Ctrl-N
+            editorHistory(false);
+            break;
+        case 16:                                                        // Ctrl-P
+            editorHistory(true);
+            break;
+        case 18:                                                        // Ctrl-R: search back through the history
+            if(hist.synced == false){
+                historySync();
+                hist.synced = true;
+            }
+            editor.saved.len = 0;
+            textAppend(&editor.saved, editor.line.data, editor.line.len);
+            editor.query.len = 0;
+            editor.searching = true;
+            editor.matched = false;
+            editor.failed = false;
+            break;
+        case 21:                                                        // Ctrl-U: cut to the start
+            editorErase(0, editor.cursor);
+            break;
+        case 23:                                                        // Ctrl-W: cut the word before the cursor
+            pos = editor.cursor;
+            while(pos > 0 && editor.line.data[pos - 1] == ' '){
+                pos--;
+            }
+            while(pos > 0 && editor.line.data[pos - 1] != ' '){
+                pos--;
+            }
+            editorErase(pos, editor.cursor);
+            break;
+        case 26:                                                        // Ctrl-Z: toggle foreground-only mode
+            stopSig(SIGTSTP);
+            break;
+        case 27:                                                        // Start of an escape sequence
+            editor.esc[0] = key;
+            editor.escLen = 1;
+            break;
+        default:
+            if(c >= 0x20){                                              // Text, including UTF-8 bytes
+                editorInsert(&key, 1);
+            }
+            break;
+    }
+    return EDIT_MORE;
 }
 
 /*
-Remove pid when background process ends
+Redraw the prompt line: "\r", prompt, the part of the line that fits, clear to the end of
+the screen line, then move the cursor back. Lines wider than the terminal scroll sideways.
 */
-void deleteBgPid(pid_t processId){
-    int i;
-    int pidPos;                                   // Stores pid position in stack
+void editorRefresh(){
+    struct winsize size;
+    size_t width = 80;
+    size_t promptCols;
+    size_t avail;
+    size_t cols;
+    size_t skip = 0;
+    size_t end;
+    size_t shown;
+    char move[32];
 
-    /* 
-    Find the pid of the bg process that ended in the pid stack
-    */
-    for(i = 0; i < pidStack.bgPidCount + 1; i++){
-        if(pidStack.bgPids[i] == processId){
-            pidPos = i;
-            break;                                 // Once pid has been located, end loop
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0){
+        width = size.ws_col;
+    }
+    fflush(stdout);                                                     // Messages printed before come first
+    editor.screen.len = 0;
+    textAppend(&editor.screen, "\r", 1);
+    if(editor.searching == true){
+        if(editor.failed == true){
+            textAppend(&editor.screen, "(failed ", 8);
         }
+        textAppend(&editor.screen, "(reverse-i-search)`", 19);
+        textAppend(&editor.screen, editor.query.data, editor.query.len);
+        textAppend(&editor.screen, "': ", 3);
     }
+    else{
+        textAppend(&editor.screen, promptText, strlen(promptText));
+    }
+    promptCols = textColumns(editor.screen.data + 1, editor.screen.len - 1);
+    avail = width > promptCols + 1 ? width - promptCols - 1 : 1;
 
-    /* 
-    Shift order of remaining pids in stack
-    */
-    for(i = pidPos; i < pidStack.bgPidCount + 1; i++){
-        pidStack.bgPids[i] = pidStack.bgPids[i+1];
+    cols = textColumns(editor.line.data, editor.cursor);
+    while(cols >= avail){                                               // Scroll until the cursor fits
+        skip = nextChar(skip);
+        cols--;
     }
-    
-    pidStack.bgPidCount--;                         // Decrement pid count
+    for(end = skip, shown = 0; end < editor.line.len && shown < avail; shown++){
+        end = nextChar(end);
+    }
+    textAppend(&editor.screen, editor.line.data + skip, end - skip);
+    textAppend(&editor.screen, "\x1b[K\r", 4);
+    if(promptCols + cols > 0){
+        snprintf(move, sizeof(move), "\x1b[%zuC", promptCols + cols);
+        textAppend(&editor.screen, move, strlen(move));
+    }
+    write(STDOUT_FILENO, editor.screen.data, editor.screen.len);
 }
 
+/*
+Show the prompt again after a message was printed over it
+*/
+void redrawPrompt(){
+    if(editing == true){
+        editorRefresh();
+        return;
+    }
+    printf("%s", promptText);
+    fflush(stdout);
+}
 
 /*
-Handles moving between directories
+Read one line from the terminal with editing and history, serving events while waiting for
+keys. The terminal is in raw mode only while the line is edited. The line is added to the
+history file and returned in the line arena; NULL at end of input.
 */
-int changeDirectory(char* inputBuffer){
-    char* homeDirPath = getenv("HOME");            // Fetch home dir path
-    char newDirPath[MAXCHAR];                      // Stores new dir path
+char* editLine(){
+    struct termios cooked;
+    struct termios raw;
+    char keys[256];
+    char *line;
+    ssize_t got;
+    size_t i;
+    int result = EDIT_MORE;
 
-    inputBuffer[strlen(inputBuffer) -1] = '\0';
+    tcgetattr(STDIN_FILENO, &cooked);
+    raw = cooked;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);                    // Key by key; Ctrl-C and Ctrl-Z arrive as keys
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
 
-    if(strcmp(inputBuffer,"cd") == 0){
-        if(chdir(homeDirPath) != 0){               // If not 0, then directory could not be found
-            printf("directory:%s not found.\n", homeDirPath);
-            return 1;
+    editor.line.len = 0;
+    editor.cursor = 0;
+    editor.histPos = 0;
+    editor.searching = false;
+    editor.escLen = 0;
+    hist.synced = false;
+    editing = true;
+
+    for(i = 0; i < editor.pending.len && result == EDIT_MORE; i++){    // Keys typed ahead of the last line
+        result = editorKey((unsigned char)editor.pending.data[i]);
+    }
+    memmove(editor.pending.data, editor.pending.data + i, editor.pending.len - i);
+    editor.pending.len -= i;
+    if(result == EDIT_MORE){
+        editorRefresh();
+    }
+    while(result == EDIT_MORE){
+        if(pollEvents(-1) == false){                                    // Only signals or children, keep waiting
+            continue;
+        }
+        got = read(STDIN_FILENO, keys, sizeof(keys));
+        if(got <= 0){
+            if(got < 0 && errno == EINTR){
+                continue;
+            }
+            result = EDIT_EOF;
+            break;
+        }
+        for(i = 0; i < (size_t)got && result == EDIT_MORE; i++){
+            result = editorKey((unsigned char)keys[i]);
+        }
+        textAppend(&editor.pending, keys + i, (size_t)got - i);         // A paste may hold several lines
+        if(result == EDIT_MORE){
+            editorRefresh();
         }
-        return 0;
     }
 
-    memset(newDirPath, '\0', sizeof(newDirPath));   // Clear str & prepare for new dir path
-    strtok(inputBuffer, " ");
-    strcpy(inputBuffer, strtok(NULL, ""));
-    
-    /* 
-    Handles commands related to directory
-    */
-    if(inputBuffer[0] == '/'){
-        sprintf(newDirPath, "%s%s", homeDirPath, inputBuffer); // Change to new dir from home dir
+    editor.searching = false;
+    editor.cursor = editor.line.len;
+    if(result == EDIT_DONE){
+        editorRefresh();
     }
-    else if(strcmp(inputBuffer, "..") == 0){                   // Go back one dir
-        strcpy(newDirPath, inputBuffer);
+    write(STDOUT_FILENO, "\n", 1);
+    editing = false;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+    if(result == EDIT_EOF){
+        return NULL;
     }
-    else if(strcmp(inputBuffer, "~") == 0){                    // Go to home dir
-        strcpy(newDirPath, homeDirPath);
+
+    historyAdd(editor.line.data, editor.line.len);
+    line = arenaAlloc(&lineArena, editor.line.len + 1);
+    memcpy(line, editor.line.data, editor.line.len);
+    line[editor.line.len] = '\0';
+    return line;
+}
+
+/*
+Wait for the foreground child while still serving signals and background exits
+*/
+void waitForeground(struct job* j){
+    while(j->state == JOB_RUNNING){
+        pollEvents(-1);
     }
-    else if(inputBuffer[0] == '.' && inputBuffer[1] == '/'){   // Stay in current working dir
-        sprintf(newDirPath, "%s", inputBuffer);
+    if(ttyControl == true){                                             // Take the terminal back and undo any mode changes
+        tcsetpgrp(STDIN_FILENO, shellPgid);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shellTermios);
     }
-    else{
-        sprintf(newDirPath, "%s", inputBuffer);                // Change to new dir path from home dir path
+    fgVal = j->status;
+    fgUsage = j->usage;                                                 // Still all zero if it only stopped
+    fgUsageValid = j->state == JOB_DONE;
+    if(j->state == JOB_STOPPED){                                        // Ctrl-Z: keep it as a background job
+        j->foreground = false;
+        assignJobId(j);
+        printf("\n[%d] Stopped %s\n", j->id, j->cmdLine);
+        return;
     }
-    if(chdir(newDirPath) != 0){                                // If directory not found
-        printf("directory:%s not found.\n", newDirPath);
-        return 1;
+    if(WIFSIGNALED(j->status) && WTERMSIG(j->status) != SIGPIPE){       // The shell no longer sees the SIGINT itself
+        terminateSig(WTERMSIG(j->status));
     }
-    return 0;
+    removeJob(j);
 }
 
+/*
+Kill all bg processes and exit
+*/
+void killBgProcess(){
+    size_t i;
+    // loop through jobs in the table
+    for(i = 0; i < jobTab.count; i++){
+        signalJob(jobTab.jobs[i], SIGINT);          // kill every process of the job
+        if(jobTab.jobs[i]->state == JOB_STOPPED){
+            signalJob(jobTab.jobs[i], SIGCONT);     // Let a stopped job act on the SIGINT
+        }
+    }
+}
 
 /*
-Checks for special chars '< > & # &' and if any are found, returns True
+Switch foreground mode if there is signal
 */
-bool hasSpecialChar(char *str){
-    bool shellOp = false;
+void switchModes(){
+    // There is a stop signal, so exit from foreground-only mode if already in it
+    if(WTERMSIG(fgVal) == 11 && runInForeground == true){
 
-    if(str == NULL){        // handles NULL to prevent segfaut
-        return true;
+        printf("\nExiting foreground-only mode\n");
+        runInForeground = false;                     // Switch foreground-only status to off/false
     }
-    if(str[0] == '&'){      // Search for bg command
-        shellOp = true;
+
+    // There is a stop signal, so enter foreground-only mode if not already in it
+    else if(WTERMSIG(fgVal) == 11 && runInForeground == false){
+
+        printf("\nEntering foreground-only mode (& is now ignored)\n");
+        runInForeground = true;                      // Switch foreground-only status to on/true
     }
-    else if(str[0] == '<'){ // Check for input redirection
-        shellOp = true;
+}
+
+/*
+"time cmd ..." runs the rest of the line as usual and prints what it cost. External commands
+are measured with wait4(), anything run inside the shell by the shell's own usage.
+*/
+void timeCommand(struct inputAttributes* obj){
+    struct rusage before;
+    struct rusage after;
+    char usage[160];
+    long long start;
+
+    if(obj->argNum == 1){
+        printf("usage: time command [args...]\n");
+        fgVal = 1 << 8;
+        return;
     }
-    else if(str[0] == '>'){ // Check for output redirection
-        shellOp = true;
+    obj->arguments++;                                       // Drop "time", the command takes its place
+    obj->argNum--;
+    obj->command = obj->arguments[0];
+    if(obj->activeBackground == true && runInForeground == false){
+        runCommand(obj);                                    // The completion notice reports the usage
+        return;
     }
-    else if(str[0] == '#'){ // Check for comment
-        shellOp = true;
+
+    getrusage(RUSAGE_SELF, &before);
+    start = nowNs();
+    fgUsageValid = false;
+    runCommand(obj);
+    if(fgUsageValid == false){                              // Builtin, or nothing could be started
+        getrusage(RUSAGE_SELF, &after);
+        memset(&fgUsage, 0, sizeof(fgUsage));
+        fgUsage.wallNs = nowNs() - start;
+        timersub(&after.ru_utime, &before.ru_utime, &fgUsage.ru.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &fgUsage.ru.ru_stime);
+        fgUsage.ru.ru_maxrss = after.ru_maxrss;
+        fgUsage.ru.ru_nvcsw = after.ru_nvcsw - before.ru_nvcsw;
+        fgUsage.ru.ru_nivcsw = after.ru_nivcsw - before.ru_nivcsw;
+        fgUsageValid = true;
     }
-    return shellOp;
+    formatUsage(usage, sizeof(usage), &fgUsage);
+    printf("%s\n", usage);
 }
 
 /*
-For initializing inputAttributes struct
+A size for "limit mem=": bytes, or K/M/G/T for KiB ... TiB
 */
-void parseInputStr(char* inputBuffer, struct inputAttributes* obj){
-    char dataBuffer[MAXCHAR]; // temp buffer to store what is in inputBuffer
-    char *inputFileName;      // Stores input file descriptor
-    char *outputFileName;     // Stores output file descriptor
-    char *temp;               // Stores the argument from data buffer
-
-    obj->argNum = 0;
-    inputBuffer[strlen(inputBuffer) -1] = '\0';     // Remove newline char
+static bool parseSize(const char* text, rlim_t* size){
+    unsigned long long value;
+    char *end;
+    int shift = 0;
 
-    if(inputBuffer[strlen(inputBuffer) -1] == '&'){ // Check if bg mode
-        obj->activeBackground = true;               // Bg mode is on
-        inputBuffer[strlen(inputBuffer) -1] = '\0'; // Ignore and remove '&'
+    errno = 0;
+    value = strtoull(text, &end, 10);
+    if(end == text || *text == '-' || errno != 0){
+        return false;
     }
-    else{
-        obj->activeBackground = false;              // Bg mode not on
+    switch(*end){
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        case 't': case 'T': shift = 40; end++; break;
+    }
+    if(*end != '\0' || value > (RLIM_INFINITY - 1) >> shift){
+        return false;
     }
+    *size = (rlim_t)(value << shift);
+    return true;
+}
 
-    /* 
-    Parse input for command and store in array
-    */
-    memset(dataBuffer, '\0', sizeof(dataBuffer));   // Clear dataBuffer
-    strcpy(dataBuffer, inputBuffer);                // Copy inputBuffer -> dataBuffer
-    strtok(dataBuffer, " ");                        // Fetch just the commands and copy into new command obj
-    strcpy(obj->command, dataBuffer);
+/*
+A CPU list such as "0-3,6" for "limit cpus=", only CPUs the shell may run on
+*/
+static bool parseCpuList(const char* text, cpu_set_t* set){
+    cpu_set_t allowed;
+    const char *p = text;
+    char *end;
+    long lo;
+    long hi;
 
-    /* 
-    Parse name of input file
-    */
-    memset(dataBuffer, '\0', sizeof(dataBuffer));
-    strcpy(dataBuffer, inputBuffer);
-    inputFileName = strstr(dataBuffer, "<");                                // Find substr after '<' char.
-    if(inputFileName != NULL){
-        memmove(inputFileName, inputFileName+2, strlen(inputFileName));     // Copy the mem block of the str, but not the operator
-        strtok(inputFileName, " ");                                         // Removes space from input file name
-        inputFileName[strlen(inputFileName)] = '\0';                        // Add null character at end of str
-        strcpy(obj->inputFile, inputFileName);                              // Copy str -> input file obj
+    CPU_ZERO(set);
+    do{
+        lo = strtol(p, &end, 10);
+        if(end == p || *p == '-' || *p == '+'){
+            return false;
+        }
+        hi = lo;
+        if(*end == '-'){
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if(end == p || hi < lo){
+                return false;
+            }
+        }
+        if(hi >= CPU_SETSIZE){
+            return false;
+        }
+        for(; lo <= hi; lo++){
+            CPU_SET(lo, set);
+        }
+        p = end + 1;
+    } while(*end == ',');
+    if(*end != '\0'){
+        return false;
     }
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    CPU_AND(set, set, &allowed);
+    return CPU_COUNT(set) > 0;
+}
 
-    /* 
-    Parse name of output file
-    */
-    memset(dataBuffer, '\0', sizeof(dataBuffer));
-    strcpy(dataBuffer, inputBuffer);
-    outputFileName = strstr(dataBuffer, ">");       // Find substr after '>' char.
-    if(outputFileName != NULL){
-        memmove(outputFileName, outputFileName+2, strlen(outputFileName));
-        strtok(outputFileName, " ");
-        outputFileName[strlen(outputFileName)] = '\0';
-        strcpy(obj->outputFile, outputFileName);    // Copy str -> output file obj
-    }
-     
-    /* 
-    Parse arguments
-    */
-    memset(dataBuffer, '\0', sizeof(dataBuffer));
-    strcpy(dataBuffer, inputBuffer);
-    strtok(dataBuffer, " ");
-
-    temp = strtok(NULL, "");
+/*
+Strip leading "nice [-n N]" and "limit [cpu=SECONDS] [mem=SIZE] [cpus=LIST] [nice=N]" words
+off obj, several may follow each other, and note what they ask for in limits. If there were
+any, every stage of obj points at limits until it is launched. Returns false, having
+printed why, for a malformed limit.
+*/
+bool takeLimits(struct inputAttributes* obj, struct jobLimits* limits){
+    struct inputAttributes *stage;
+    bool found = false;
+    bool limit;
+    char *word;
+    char *end;
+    long value;
+    int used;
 
-    if(hasSpecialChar(temp) == false){                      // Check for any special chars/arguments
-        strcpy(dataBuffer, temp);                           // If found, Copy argument -> dataBuffer
-        strtok(dataBuffer, "<>#");                          // Take special chars before any aguments
-        
-        strtok(dataBuffer, " ");                            // Remove space from the argument str
-        obj->arguments[0] = dataBuffer;                     // Assign what is in dataBuffer as first argument
-        obj->argNum = 1;                                    // First argument inputted
-        temp = strtok(NULL, " ");                           // Prep for locating any other arguments in input
-        while(temp != NULL){
-            obj->arguments[obj->argNum] = temp;             // Store rest of arguments and increment argument counter
-            obj->argNum++;
-            temp = strtok(NULL, " ");
+    memset(limits, 0, sizeof(struct jobLimits));
+    limits->cpuSeconds = RLIM_INFINITY;
+    limits->memBytes = RLIM_INFINITY;
+    limits->procsFd = -1;
+    while(obj->command != NULL && (strcmp(obj->command, "nice") == 0 || strcmp(obj->command, "limit") == 0)){
+        used = 1;
+        limit = strcmp(obj->command, "limit") == 0;
+        if(limit == false){
+            value = 10;                                         // nice(1)'s default adjustment
+            if(obj->arguments[1] != NULL && strcmp(obj->arguments[1], "-n") == 0){
+                word = obj->arguments[2];
+                value = word != NULL ? strtol(word, &end, 10) : 0;
+                if(word == NULL || end == word || *end != '\0'){
+                    printf("nice: -n needs a number\n");
+                    return false;
+                }
+                used = 3;
+            }
+            limits->niceness += (int)value;
+        }
+        for(; limit == true && (word = obj->arguments[used]) != NULL && strchr(word, '=') != NULL; used++){
+            if(strncmp(word, "cpu=", 4) == 0){
+                value = strtol(word + 4, &end, 10);
+                if(end == word + 4 || *end != '\0' || value <= 0){
+                    printf("limit: cpu= takes seconds of CPU time\n");
+                    return false;
+                }
+                limits->cpuSeconds = (rlim_t)value;
+            }
+            else if(strncmp(word, "mem=", 4) == 0){
+                if(parseSize(word + 4, &limits->memBytes) == false || limits->memBytes == 0){
+                    printf("limit: mem= takes a size such as 512M\n");
+                    return false;
+                }
+            }
+            else if(strncmp(word, "cpus=", 5) == 0){
+                if(parseCpuList(word + 5, &limits->cpus) == false){
+                    printf("limit: cpus=%s: no such CPU available\n", word + 5);
+                    return false;
+                }
+                limits->cpuText = word + 5;
+            }
+            else if(strncmp(word, "nice=", 5) == 0){
+                value = strtol(word + 5, &end, 10);
+                if(end == word + 5 || *end != '\0'){
+                    printf("limit: nice= takes a number\n");
+                    return false;
+                }
+                limits->niceness += (int)value;
+            }
+            else{
+                printf("limit: unknown limit %s\n", word);
+                return false;
+            }
+        }
+        obj->arguments += used;                                 // Drop the prefix, the command takes its place
+        obj->argNum -= used;
+        obj->command = obj->arguments[0];
+        found = true;
+    }
+    if(found == true){
+        for(stage = obj; stage != NULL; stage = stage->next){
+            stage->limits = limits;
         }
-        obj->arguments[obj->argNum] = strtok(NULL, "");     // Fetch final argument
     }
+    return true;
 }
 
 /*
-Create list of args to pass to execvp
+"nice [-n N] command ..." and "limit [cpu=SECONDS] [mem=SIZE] [cpus=LIST] [nice=N] command ..."
+run the command (or pipeline) as a separate process with those limits, see takeLimits().
+"nice" alone prints the shell's niceness, "limit" alone where job cgroups are made.
 */
-void listOfArgs(struct inputAttributes* obj, char** argsArray){
-    int i;
+void limitCommand(struct inputAttributes* obj){
+    struct jobLimits limits;
+    struct inputAttributes *stage;
+    bool nice = strcmp(obj->command, "nice") == 0;
 
-    argsArray[0] = obj->command;                            // Store command as the first argument
-    for(i = 0; i < obj->argNum ; i++){                      // Loop through argument array
-        if(getenv(obj->arguments[i]) != NULL){              // If environment variable not null
-            argsArray[i+1] = getenv(obj->arguments[i]);     // Add it to list as argument
+    fgVal = 0;
+    if(obj->argNum == 1 && obj->next == NULL){
+        if(nice == true){
+            printf("%d\n", getpriority(PRIO_PROCESS, 0));
         }
-        else if(strcmp(obj->arguments[i], "$$") == 0){      // Checks if '$$' chars needs to be expanded
-            sprintf(argsArray[i+1], "%d", getpid());        // Expand '$$' chars into pid
+        else if(findCgroup() == true){
+            printf("job cgroups in %s\n", cgroupBase);
         }
         else{
-            argsArray[i+1] = (obj->arguments[i]);           // Curr argument obj gets added to the list as argument
+            printf("no writable cgroup2 hierarchy, mem= sets RLIMIT_AS\n");
         }
+        return;
+    }
+    if(takeLimits(obj, &limits) == false){
+        fgVal = 1 << 8;
+        return;
+    }
+    if(obj->command == NULL){
+        printf("usage: %s\n", nice == true ? "nice [-n N] command [args...]" :
+               "limit [cpu=SECONDS] [mem=SIZE] [cpus=LIST] [nice=N] command [args...]");
+        fgVal = 1 << 8;
+    }
+    else if(obj->next == NULL && isShellCommand(obj->command) == true){
+        printf("%s: runs in the shell, it can't be limited\n", obj->command);
+        fgVal = 1 << 8;
+    }
+    else{
+        runCommand(obj);                                    // Builtins and functions run as commands from PATH now
+    }
+    for(stage = obj; stage != NULL; stage = stage->next){
+        stage->limits = NULL;                               // limits goes away with this call
     }
-    argsArray[i+1] = NULL;                                  // Close argument array
 }
 
 /*
-For redirecting input and output
+Print one limit the way "ulimit" shows it
 */
-void handleRedirection(struct inputAttributes* obj){
-    int inputFileDescriptor = STDIN_FILENO;
-    int outputFileDescriptor = STDOUT_FILENO;
+static void printLimit(rlim_t value, rlim_t unit){
+    if(value == RLIM_INFINITY){
+        printf("unlimited\n");
+    }
+    else{
+        printf("%llu\n", (unsigned long long)(value / unit));
+    }
+}
 
-    if(obj->inputFile[0] != '\0'){                           // Make sure input file is not empty, then open it for read only
-        inputFileDescriptor = open(obj->inputFile, O_RDONLY);
+/*
+"ulimit [-SH] [-a | -cdflmnstuv] [value|unlimited]" shows or sets the shell's own resource
+limits, which every command started afterwards inherits. Without -S or -H a new value sets
+both and the soft one is shown. -f is the resource when none is named.
+*/
+void ulimitCommand(struct inputAttributes* obj){
+    const struct ulimitResource *res = &ulimitResources[2];
+    struct rlimit rl;
+    unsigned long long value = 0;
+    bool soft = false;
+    bool hard = false;
+    bool all = false;
+    char *word;
+    char *end;
+    size_t k;
+    int i;
 
-        if(inputFileDescriptor < 0){                         // If error opening file, print err message
-            printf("cannot open %s for input\n", obj->inputFile);
-            exit(1);
+    fgVal = 0;
+    for(i = 1; (word = obj->arguments[i]) != NULL && word[0] == '-' && word[1] != '\0'; i++){
+        for(word++; *word != '\0'; word++){
+            if(*word == 'S' || *word == 'H' || *word == 'a'){
+                soft |= *word == 'S';
+                hard |= *word == 'H';
+                all |= *word == 'a';
+                continue;
+            }
+            for(k = 0; k < sizeof(ulimitResources) / sizeof(ulimitResources[0]) && ulimitResources[k].option != *word; k++);
+            if(k == sizeof(ulimitResources) / sizeof(ulimitResources[0])){
+                printf("usage: ulimit [-SH] [-a | -cdflmnstuv] [value|unlimited]\n");
+                fgVal = 1 << 8;
+                return;
+            }
+            res = &ulimitResources[k];
         }
-        dup2(inputFileDescriptor, 0);                        // Call dup2() for input redirection
-        close(inputFileDescriptor);                          // Close the file descriptor
     }
-    if(obj->outputFile[0] != '\0'){                          // If output file not empty, open for creating/truncating and assign permissions
-        outputFileDescriptor = open(obj->outputFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-        if(outputFileDescriptor < 0){                        // If error opening output file, print err message
-            printf("error opening or creating file\n");
-            exit(1);
+    if(all == true){
+        for(k = 0; k < sizeof(ulimitResources) / sizeof(ulimitResources[0]); k++){
+            getrlimit(ulimitResources[k].resource, &rl);
+            printf("%-26s (-%c) ", ulimitResources[k].name, ulimitResources[k].option);
+            printLimit(hard == true ? rl.rlim_max : rl.rlim_cur, ulimitResources[k].unit);
+        }
+        return;
+    }
+    getrlimit(res->resource, &rl);
+    if(word == NULL){
+        printLimit(hard == true && soft == false ? rl.rlim_max : rl.rlim_cur, res->unit);
+        return;
+    }
+
+    if(strcmp(word, "unlimited") != 0){
+        errno = 0;
+        value = strtoull(word, &end, 10);
+        if(end == word || *end != '\0' || *word == '-' || errno != 0 || value > (RLIM_INFINITY - 1) / res->unit){
+            printf("ulimit: %s: bad number\n", word);
+            fgVal = 1 << 8;
+            return;
         }
-        dup2(outputFileDescriptor, 1);                       // Call dup2() for output redirection
-        close(outputFileDescriptor);                         // Close the file descriptor
+    }
+    if(soft == true || hard == false){
+        rl.rlim_cur = strcmp(word, "unlimited") == 0 ? RLIM_INFINITY : (rlim_t)value * res->unit;
+    }
+    if(hard == true || soft == false){
+        rl.rlim_max = strcmp(word, "unlimited") == 0 ? RLIM_INFINITY : (rlim_t)value * res->unit;
+    }
+    if(setrlimit(res->resource, &rl) < 0){
+        printf("ulimit: %s\n", strerror(errno));
+        fgVal = 1 << 8;
     }
 }
 
 /*
-Fork off child process
+Write text to a file of a cgroup directory
 */
-void forkOff(struct inputAttributes* obj){
-    pid_t pid = fork();
-    pid_t topOfBgPid;                                                           // Top of background pid stack
-    char *argList[MAXARG];
-    int procVal;
-
-    switch(pid){
-        // if -1, then an error has occured when forking
-        case -1:
-            printf("error when forking\n");
-            exit(1);
-            break;
-
-        // If 0, then we have a child process
-        case 0:
-            handleRedirection(obj);
-            listOfArgs(obj, argList);                                           // Create list of arguments with obj
-            execvp(obj->command, argList);                                      // Replace the current process with obj command
-            printf("%s: no such file or directory\n", argList[0]);
-            exit(1);
-            break;
+static bool cgroupWrite(const char* dir, const char* file, const char* text){
+    char path[MAXCHAR];
+    bool ok;
+    int fd;
 
-        // we have a parent process
-        default:
-            if(obj->activeBackground == true && runInForeground == false){      // If in bg mode
-                // Add pid of bg process to pid stack
-                pidStack.bgPids[++(pidStack.bgPidCount)] = pid;
-                // Fetch and return pid at top of stack
-                topOfBgPid = pidStack.bgPids[pidStack.bgPidCount];
-                printf("background pid is %d\n", topOfBgPid);
-            }
-            else{
-                // Wait for child process to end if bg mode not on
-                waitpid(pid, &procVal, 0);
-                fgVal = procVal;
-            }
-            break;
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    fd = open(path, O_WRONLY | O_CLOEXEC);
+    if(fd < 0){
+        return false;
     }
+    ok = write(fd, text, strlen(text)) == (ssize_t)strlen(text);
+    close(fd);
+    return ok;
 }
 
 /*
-Stop signal to switch back and forth between foreground mode
+Find the cgroup2 directory the shell runs in, on first use. Job cgroups for "limit" are made
+below it, with the memory and cpuset controllers if they can be enabled there. Returns false
+if there is no cgroup2 hierarchy the shell can write to.
 */
-void stopSig(int sig){  
-    if(runInForeground == false){ // If not already in foreground mode
-        char* message = ("\nEntering foreground-only mode (& is now ignored)\n");
-        write(STDOUT_FILENO, message, 50);
-        runInForeground = true;   // Status of foreground mode is switched to on/true
+bool findCgroup(){
+    char line[MAXCHAR];
+    char mount[MAXCHAR] = "";
+    char own[MAXCHAR] = "";
+    FILE *file;
+    size_t len;
+
+    if(cgroupState != 0){
+        return cgroupState > 0;
     }
-    else{
-        // For exiting foreground mode
-        char* message = "\nExiting foreground-only mode\n";
-        write(STDOUT_FILENO, message, 31);
-        runInForeground = false;  // Status of foreground mode is switche back to off/false
+    cgroupState = -1;
+    file = fopen("/proc/self/mountinfo", "re");
+    while(file != NULL && fgets(line, sizeof(line), file) != NULL){
+        if(strstr(line, " - cgroup2 ") != NULL && sscanf(line, "%*s %*s %*s %*s %2047s", mount) == 1){
+            break;
+        }
+    }
+    if(file != NULL){
+        fclose(file);
+    }
+    file = fopen("/proc/self/cgroup", "re");
+    while(file != NULL && fgets(line, sizeof(line), file) != NULL){
+        if(strncmp(line, "0::", 3) == 0){                       // The cgroup2 entry
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(own, sizeof(own), "%s", strcmp(line + 3, "/") == 0 ? "" : line + 3);
+            break;
+        }
+    }
+    if(file != NULL){
+        fclose(file);
+    }
+    if(mount[0] == '\0' || strlen(mount) + strlen(own) >= MAXCHAR - 64){
+        return false;
     }
+    len = strlen(mount);
+    cgroupBase = malloc(len + strlen(own) + 1);
+    if(cgroupBase == NULL){
+        return false;
+    }
+    memcpy(cgroupBase, mount, len);
+    strcpy(cgroupBase + len, own);
+    if(access(cgroupBase, W_OK) != 0){
+        free(cgroupBase);
+        cgroupBase = NULL;
+        return false;
+    }
+    cgroupWrite(cgroupBase, "cgroup.subtree_control", "+memory");  // Fails if the shell's cgroup can't delegate them,
+    cgroupWrite(cgroupBase, "cgroup.subtree_control", "+cpuset");  // mem= then falls back to RLIMIT_AS
+    cgroupState = 1;
+    return true;
 }
 
 /*
-Handles ending of child process
+Make the job its own cgroup for "limit mem=" or "cpus=", where cgroup2 is writable, and open
+its cgroup.procs for the stages to join. memory.max takes the place of RLIMIT_AS, which
+counts mappings rather than memory used; cpuset.cpus keeps the job from widening its affinity.
 */
-void childSig(int sig){
-    pid_t cPid;
-    int cStatus;
-    int i;
-    // Look for pid of exited/terminated process in stack
-    for(i = 0; i < pidStack.bgPidCount + 1; i++){
-        cPid = waitpid(pidStack.bgPids[i], &cStatus, WNOHANG);         // Find pid of child
+void startCgroup(struct job* j, struct jobLimits* limits){
+    char path[MAXCHAR];
+    char text[32];
 
-        if((cStatus == 0 || cStatus == 1) && cPid != 0 ){              // If process exited
-            fprintf(stdout, "\nBackground pid %d is done: exit value %d\n", cPid,cStatus);
-            deleteBgPid(cPid);                                         // Removes child's pid from stack
-        }
-        else if(cPid != 0){                                            // If process terminated
-            fprintf(stdout, "\nBackground pid %d is done: terminated by signal %d\n", cPid, cStatus);
-            deleteBgPid(cPid);
+    if((limits->memBytes == RLIM_INFINITY && limits->cpuText == NULL) || j->cgroup != NULL || findCgroup() == false){
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/smallsh-%d-%u", cgroupBase, (int)getpid(), cgroupSerial++);
+    if(mkdir(path, 0755) < 0){
+        if(errno == EROFS || errno == EACCES || errno == EPERM){  // Won't work for later jobs either
+            cgroupState = -1;
         }
+        return;
+    }
+    j->cgroup = strdup(path);
+    if(limits->memBytes != RLIM_INFINITY){
+        snprintf(text, sizeof(text), "%llu", (unsigned long long)limits->memBytes);
+        limits->memInCgroup = cgroupWrite(path, "memory.max", text);
     }
+    if(limits->cpuText != NULL){
+        cgroupWrite(path, "cpuset.cpus", limits->cpuText);
+    }
+    strcat(path, "/cgroup.procs");
+    limits->procsFd = shellFd(open(path, O_WRONLY | O_CLOEXEC));
 }
 
 /*
-Handles termination of process
+Start tracing into path. The ring is filled by the shell and drained by a writer thread,
+so recording an event is a copy into memory, never a syscall.
 */
-void terminateSig(int sig){
-    printf("\nterminated by signal %d\n", sig);                         // Outputs signal that terminated process
+bool traceOpen(const char* path){
+    if(traceOn == true){
+        traceClose();
+    }
+    traceRing.fd = shellFd(open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644));   // The writer thread must not follow a redirection
+    if(traceRing.fd < 0){
+        printf("trace: cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if(traceRing.records == NULL){
+        traceRing.records = malloc(TRACE_RING * sizeof(struct traceRecord));
+        if(traceRing.records == NULL){
+            perror("trace");
+            exit(1);
+        }
+    }
+    atomic_store(&traceRing.head, 0);
+    atomic_store(&traceRing.tail, 0);
+    atomic_store(&traceRing.stop, false);
+    traceRing.dropped = 0;
+    if(pthread_create(&traceRing.writer, NULL, traceWriter, NULL) != 0){
+        printf("trace: cannot start the writer thread\n");
+        close(traceRing.fd);
+        return false;
+    }
+    traceOn = true;
+    return true;
 }
 
 /*
-Frees input obj memory
+Stop tracing: the writer drains what is left and exits
 */
-void freeInputMem(struct inputAttributes* obj)
-{
-    obj->activeBackground = false;                                      // Restore bg mode status to default
+void traceClose(){
+    if(traceOn == false){
+        return;
+    }
+    traceOn = false;
+    atomic_store(&traceRing.stop, true);
+    pthread_join(traceRing.writer, NULL);
+    close(traceRing.fd);
+    traceRing.fd = -1;
+}
 
-    // clear inputAttributes
-    memset(obj->inputFile, '\0', sizeof(obj->inputFile));
-    memset(obj->outputFile, '\0', sizeof(obj->outputFile));
-    memset(obj->command, '\0', sizeof(obj->command));
+/*
+Record one event. ns is when it happened, 0 for now. value is the line length for
+TRACE_READ, the number of stages for TRACE_PARSE and the exit status otherwise.
+*/
+void traceEvent(int type, long long ns, pid_t pid, struct job* j, int value, struct inputAttributes* obj){
+    size_t head;
+    struct traceRecord *rec;
+    struct redirection *r;
 
-    free(obj);
+    if(traceOn == false){
+        return;
+    }
+    head = atomic_load_explicit(&traceRing.head, memory_order_relaxed);
+    if(head - atomic_load_explicit(&traceRing.tail, memory_order_acquire) == TRACE_RING){
+        traceRing.dropped++;                                        // Writer fell behind, keep the shell fast
+        return;
+    }
+    rec = &traceRing.records[head & (TRACE_RING - 1)];
+    rec->ns = ns != 0 ? ns : nowNs();
+    rec->type = type;
+    rec->pid = pid;
+    rec->jobId = j != NULL ? j->id : 0;
+    rec->value = value;
+    rec->dropped = traceRing.dropped;
+    rec->command[0] = '\0';
+    rec->inputFile[0] = '\0';
+    rec->outputFile[0] = '\0';
+    if(obj != NULL){
+        snprintf(rec->command, sizeof(rec->command), "%s", obj->command != NULL ? obj->command : "");
+        for(r = obj->redirs; r != NULL; r = r->next){           // The files that end up as stdin and stdout
+            if(r->fd == STDIN_FILENO && r->type == REDIR_IN){
+                snprintf(rec->inputFile, sizeof(rec->inputFile), "%s", r->word);
+            }
+            else if(r->fd == STDOUT_FILENO && (r->type == REDIR_OUT || r->type == REDIR_APPEND)){
+                snprintf(rec->outputFile, sizeof(rec->outputFile), "%s", r->word);
+            }
+        }
+    }
+    atomic_store_explicit(&traceRing.head, head + 1, memory_order_release);
 }
 
 /*
-Kill all bg processes and exit
+Append str to out as the body of a JSON string
 */
-void killBgProcess(){
-    int i;
-    // loop through pids in stack
-    for(i = 0; i < pidStack.bgPidCount + 1; i++){
-        kill(pidStack.bgPids[i], SIGINT);           // kill process
-        usleep(2000);                               // To avoid competition between signals and commands that happen at the same time
+static char* traceEscape(char* out, const char* str){
+    for(; *str != '\0'; str++){
+        if(*str == '"' || *str == '\\'){
+            *out++ = '\\';
+            *out++ = *str;
+        }
+        else if((unsigned char)*str < 0x20){
+            out += sprintf(out, "\\u%04x", *str);
+        }
+        else{
+            *out++ = *str;
+        }
     }
+    return out;
 }
 
 /*
-Switch foreground mode if there is signal
+Writer thread: every few ms turn the new records into JSON lines and write them in one go
 */
-void switchModes(){
-    // There is a stop signal, so exit from foreground-only mode if already in it
-    if(WTERMSIG(fgVal) == 11 && runInForeground == true){
+void* traceWriter(void* arg){
+    const char *names[] = {"read", "parse", "spawn", "exec", "exit", "reap", "builtin"};
+    const char *valueNames[] = {"len", "stages", NULL, NULL, NULL, "status", "status"};
+    const struct timespec pause = {0, 5 * 1000000};
+    const size_t size = TRACE_RING / 8 * 512;                       // Room for an eighth of the ring per write
+    char *buf = malloc(size);
+    char *out;
+    struct traceRecord *rec;
+    size_t tail;
+    size_t head;
+    bool stopping;
 
-        printf("\nExiting foreground-only mode\n");
-        runInForeground = false;                     // Switch foreground-only status to off/false
+    (void)arg;
+    if(buf == NULL){
+        return NULL;
     }
+    do{
+        stopping = atomic_load(&traceRing.stop);                    // Read before draining, so nothing is left behind
+        tail = atomic_load_explicit(&traceRing.tail, memory_order_relaxed);
+        head = atomic_load_explicit(&traceRing.head, memory_order_acquire);
+        while(tail != head){
+            out = buf;
+            for(; tail != head && (size_t)(out - buf) <= size - TRACE_LINE; tail++){
+                rec = &traceRing.records[tail & (TRACE_RING - 1)];
+                out += sprintf(out, "{\"ns\":%lld,\"event\":\"%s\",\"pid\":%d,\"job\":%d", rec->ns, names[rec->type],
+                               (int)rec->pid, rec->jobId);
+                if(valueNames[rec->type] != NULL){
+                    out += sprintf(out, ",\"%s\":%d", valueNames[rec->type], rec->value);
+                }
+                if(rec->command[0] != '\0'){
+                    out = traceEscape(out + sprintf(out, ",\"cmd\":\""), rec->command);
+                    *out++ = '"';
+                }
+                if(rec->inputFile[0] != '\0'){
+                    out = traceEscape(out + sprintf(out, ",\"in\":\""), rec->inputFile);
+                    *out++ = '"';
+                }
+                if(rec->outputFile[0] != '\0'){
+                    out = traceEscape(out + sprintf(out, ",\"out\":\""), rec->outputFile);
+                    *out++ = '"';
+                }
+                if(rec->dropped != 0){
+                    out += sprintf(out, ",\"dropped\":%lu", rec->dropped);
+                }
+                *out++ = '}';
+                *out++ = '\n';
+            }
+            atomic_store_explicit(&traceRing.tail, tail, memory_order_release);
+            if(write(traceRing.fd, buf, out - buf) < 0){
+                break;
+            }
+        }
+        if(stopping == false){
+            nanosleep(&pause, NULL);
+        }
+    } while(stopping == false);
+    free(buf);
+    return NULL;
+}
 
-    // There is a stop signal, so enter foreground-only mode if not already in it
-    else if(WTERMSIG(fgVal) == 11 && runInForeground == false){
-
-        printf("\nEntering foreground-only mode (& is now ignored)\n");
-        runInForeground = true;                      // Switch foreground-only status to on/true
+/*
+"trace file" records every command into file as JSON lines, "trace off" stops, "trace" shows the state
+*/
+void traceCommand(struct inputAttributes* obj){
+    if(obj->argNum == 1){
+        printf("trace %s, %lu events dropped\n", traceOn == true ? "on" : "off", traceRing.dropped);
+    }
+    else if(strcmp(obj->arguments[1], "off") == 0){
+        traceClose();
+    }
+    else if(traceOpen(obj->arguments[1]) == false){
+        fgVal = 1 << 8;
     }
 }
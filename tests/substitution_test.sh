@@ -0,0 +1,55 @@
+#!/bin/sh
+# "$(...)" runs commands that change the shell (exit, cd, export, functions) in a subshell:
+# "$(exit 3)" only sets the substituted status and "$(cd ..)" leaves the shell where it was.
+#
+# Run from the repo root after compiling the shell:
+#     gcc -pthread -o shell shell.c
+#     sh tests/substitution_test.sh [./shell]
+
+shell=$(cd "$(dirname "${1:-./shell}")" && pwd)/$(basename "${1:-./shell}")
+failed=0
+
+# check NAME EXPECTED SCRIPT [DIR]: run SCRIPT with "shell -c" (in DIR) and compare its output
+check(){
+    actual=$(cd "${4:-.}" && "$shell" -c "$3" 2>&1)
+    if [ "$actual" = "$2" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1"
+        echo "  expected: $(printf '%s' "$2" | tr '\n' '|')"
+        echo "  actual:   $(printf '%s' "$actual" | tr '\n' '|')"
+        failed=1
+    fi
+}
+
+check "exit in a substitution sets its status" "status=3
+after" 'x=$(exit 3)
+echo status=$?
+echo after'
+
+check "exit in a substitution keeps the shell running" "xy
+after" 'echo x$(exit 3)y
+echo after'
+
+work=$(mktemp -d)
+mkdir "$work/sub"
+check "cd in a substitution leaves pwd unchanged" "$work/sub
+$work/sub" 'pwd
+x=$(cd ..)
+pwd' "$work/sub"
+rm -rf "$work"
+
+check "export in a substitution stays there" "X=." 'x=$(export X=1)
+echo X=$X.'
+
+check "function in a substitution sets nothing outside" "in-f G=." 'f() { echo in-f; G=2; }
+echo $(f) G=$G.'
+
+# Words of a function body are run again on every call, export must leave them as written
+check "export in a function sets the same value on every call" "fast" 'f() { export M=fast; }
+f
+M=slow
+f
+echo $M'
+
+exit $failed